@@ -1,38 +1,204 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
-#define KEY_MAX 64
-#define VAL_MAX 128
-#define BODY_MAX 256
+#include "hist.h"
+#include "perf.h"
+#include "report.h"
+#include "workload.h"
+
 #define REPLY_MAX 256
+#define RBUF_SIZE 4096
+#define REPLY_TIMEOUT_US 1000000
+#define MAX_EVENTS 256
+#define CONNECT_TIMEOUT_NS 10000000000ULL
+#define LATE_SLACK_NS 100000 // epoll engine: timer wake-up jitter allowance
 
+typedef enum {
+  CONN_PERSISTENT, // one socket reused for every request
+  CONN_CHURN,      // connect/close around every request
+} conn_mode;
+
+// One logical operation: what next_op() drew from the workload, plus its
+// progress once it is in flight on a pipelined or async connection.
 typedef struct {
-  uint64_t count;
-  uint64_t total_ns;
-} metric;
+  uint64_t t0;     // send (or intended send) time
+  int op;          // op_kind, for recording the latency
+  uint32_t key_id;
+  uint32_t seed;   // set/rmw: value seed
+  uint32_t size;   // set/rmw: value size (0 = default value)
+  uint32_t step;   // requests of this op already answered
+  uint32_t steps;  // requests the op issues (scan length, 2 for rmw)
+  const char *key; // replayed key; NULL means "k<key_id>"
+} pending;
+
+typedef enum {
+  SHADOW_UNKNOWN, // never written, or a write's outcome was lost
+  SHADOW_ABSENT,
+  SHADOW_PRESENT, // holds make_value(seed, size)
+} shadow_state;
+
+// --verify: what the client expects the server to hold for one key, plus
+// the value before the last write so stale reads can be told apart.
+typedef struct {
+  uint32_t seed;
+  uint32_t size;
+  uint32_t prev_seed;
+  uint32_t prev_size;
+  uint8_t state; // shadow_state
+  uint8_t prev_state;
+} shadow_entry;
+
+typedef struct {
+  const char *host;
+  int port;
+  conn_mode mode;
+  int fd;
+  char rbuf[RBUF_SIZE];
+  size_t rpos;
+  size_t rlen;
+  pending *inflight; // FIFO of outstanding requests; replies come in order
+  unsigned depth;    // capacity of inflight
+  unsigned head;
+  unsigned count;
+} conn;
 
 static void usage(const char *prog) {
   fprintf(stderr,
-          "%s <host> <port> <requests> <keyspace>\n"
+          "%s [options] <host> <port> <requests> <keyspace>\n"
+          "\n"
+          "Options:\n"
+          "  -t, --threads N      load-generating threads (default 1)\n"
+          "  -c, --connections N  persistent connections per thread, used "
+          "round-robin (default 1)\n"
+          "      --churn          open a new connection for every request\n"
+          "  -r, --rate R         open loop: send R ops/s in total, measuring\n"
+          "                       latency from the intended send time\n"
+          "      --arrival MODE   open-loop inter-arrival: fixed or poisson\n"
+          "                       (default fixed)\n"
+          "  -p, --pipeline N     keep up to N requests in flight per "
+          "connection\n"
+          "                       (default 1; needs persistent connections)\n"
+          "  -e, --engine NAME    sync (blocking, default) or epoll "
+          "(non-blocking,\n"
+          "                       for thousands of connections per thread)\n"
+          "      --replay FILE    replay a trace captured by the server "
+          "instead of\n"
+          "                       generating requests; <requests> caps the "
+          "records\n"
+          "      --speed X        replay at X times the captured speed "
+          "(default 1;\n"
+          "                       0 = as fast as possible)\n"
+          "  -k, --keys SPEC      key distribution, see below\n"
+          "  -m, --mix SPEC       operation mix, see below\n"
+          "  -v, --values SPEC    value size distribution, see below\n"
+          "  -f, --format FMT     results as text (default), json or csv\n"
+          "  -i, --interval S     also report throughput and latency every "
+          "S seconds\n"
+          "      --interval-out FILE\n"
+          "                       with -i: write interval reports to FILE "
+          "(default\n"
+          "                       stdout for text results, stderr for json "
+          "and csv)\n"
+          "  -d, --duration S     run for S seconds instead of a fixed count; "
+          "<requests>\n"
+          "                       then caps the run (0 = no cap)\n"
+          "      --warmup-seconds S\n"
+          "                       with -d: run S seconds of load before "
+          "measuring\n"
+          "      --cooldown-seconds S\n"
+          "                       with -d: keep the load on S seconds after "
+          "measuring\n"
+          "      --sweep MODE:FROM:TO:STEP\n"
+          "                       step the load from FROM to TO, holding "
+          "each step\n"
+          "                       for -d seconds (default 5), and report the "
+          "knee;\n"
+          "                       MODE is rate (open-loop ops/s) or pipeline\n"
+          "                       (closed loop, requests in flight per "
+          "connection)\n"
+          "      --slo-p99 US     p99 objective for the knee (default 1000)\n"
+          "      --co-correct US  closed loop: also report latencies "
+          "corrected for\n"
+          "                       coordinated omission, taking US "
+          "microseconds as the\n"
+          "                       intended gap between a connection's "
+          "requests; a\n"
+          "                       reply slower than that back-fills the "
+          "requests its\n"
+          "                       stall held back (open loop needs none: "
+          "latency\n"
+          "                       already runs from the intended send time)"
+          "\n"
+          "      --pregen         encode every request before the run starts, "
+          "so the\n"
+          "                       timed loop only sends (sync engine, fixed "
+          "count)\n"
+          "      --perf           count cycles, instructions and LLC, dTLB "
+          "and\n"
+          "                       branch misses of the client threads per op "
+          "(user\n"
+          "                       space; not with --sweep)\n"
+          "      --verify         check every read against the values "
+          "written and\n"
+          "                       count wrong, stale and missing replies "
+          "(exit\n"
+          "                       status 3 if any); sync engine only\n"
+          "      --warmup-threads N\n"
+          "                       connections populating the keyspace before "
+          "the\n"
+          "                       run (default: the -t thread count)\n"
+          "\n"
+          "Key distributions (-k/--keys):\n"
+          "  uniform             every key equally likely (default)\n"
+          "  zipfian[:T]         skewed towards key 0, theta T (0.99)\n"
+          "  scrambled[:T]       zipfian with hot keys spread over the "
+          "keyspace\n"
+          "  hotspot[:F:P]       P of requests on a fraction F of keys "
+          "(0.2:0.8)\n"
+          "  latest[:T]          sets insert new keys, reads favour recent "
+          "ones\n"
+          "\n"
+          "Value sizes (-v/--values):\n"
+          "  default             short \"v<n>\" values\n"
+          "  fixed:N             N bytes\n"
+          "  uniform:MIN:MAX     uniform between MIN and MAX bytes\n"
+          "  normal:MEAN:SD      normal, clamped to 1..4 MiB\n"
+          "  file:PATH           \"<size> [weight]\" lines from PATH\n"
           "\n"
-          "Workload mix:\n"
-          "  get: 70%%\n"
-          "  set: 20%%\n"
-          "  del: 10%%\n"
+          "Workload mix (-m/--mix):\n"
+          "  default             get 70%%, set 20%%, del 10%%\n"
+          "  ycsb-a .. ycsb-f    YCSB core workloads; also select zipfian\n"
+          "                      (latest for ycsb-d) keys unless -k is given\n"
+          "  get:N,set:N,...     custom percentages of get, set, del, scan\n"
+          "                      and rmw, adding up to 100\n"
           "\n"
           "Example:\n"
-          "  %s 127.0.0.1 12345 50000 1024\n",
-          prog, prog);
+          "  %s -t 4 -c 8 127.0.0.1 12345 50000 1024\n"
+          "  %s -e epoll -t 4 -c 5000 127.0.0.1 12345 1000000 1024\n",
+          prog, prog, prog);
 }
 
 static uint64_t now_ns(void) {
@@ -41,10 +207,31 @@ static uint64_t now_ns(void) {
   return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
 }
 
-static int send_all(int fd, const char *buf, size_t len) {
+// Writes the length header and the body with one writev() where possible.
+static int send_frame(int fd, const char *hdr, size_t hdr_len, const char *body,
+                      size_t body_len) {
+  struct iovec iov[2];
+  size_t total = hdr_len + body_len;
   size_t off = 0;
-  while (off < len) {
-    ssize_t w = write(fd, buf + off, len - off);
+
+  while (off < total) {
+    struct iovec *v = iov;
+    int cnt = 2;
+    ssize_t w;
+
+    if (off >= hdr_len) {
+      v = &iov[1];
+      cnt = 1;
+      iov[1].iov_base = (char *)body + (off - hdr_len);
+      iov[1].iov_len = body_len - (off - hdr_len);
+    } else {
+      iov[0].iov_base = (char *)hdr + off;
+      iov[0].iov_len = hdr_len - off;
+      iov[1].iov_base = (char *)body;
+      iov[1].iov_len = body_len;
+    }
+
+    w = writev(fd, v, cnt);
     if (w < 0) {
       if (errno == EINTR) {
         continue;
@@ -58,6 +245,9 @@ static int send_all(int fd, const char *buf, size_t len) {
 
 static int connect_to(const char *host, int port) {
   struct sockaddr_in addr;
+  struct timeval tv = {.tv_sec = REPLY_TIMEOUT_US / 1000000,
+                       .tv_usec = REPLY_TIMEOUT_US % 1000000};
+  int one = 1;
   int fd = socket(AF_INET, SOCK_STREAM, 0);
   if (fd < 0) {
     return -1;
@@ -77,180 +267,2665 @@ static int connect_to(const char *host, int port) {
     return -1;
   }
 
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+    close(fd);
+    return -1;
+  }
+
   return fd;
 }
 
-static int send_cmd(const char *host, int port, const char *body, int want_reply,
-                    char *reply_buf, size_t reply_cap) {
-  char packet[512];
-  int fd;
-  size_t body_len = strlen(body);
-  int n = snprintf(packet, sizeof(packet), "%zu:%s", body_len, body);
-  if (n <= 0 || (size_t)n >= sizeof(packet)) {
+static int conn_init(conn *c, const char *host, int port, conn_mode mode,
+                     unsigned depth) {
+  c->host = host;
+  c->port = port;
+  c->mode = mode;
+  c->fd = -1;
+  c->rpos = 0;
+  c->rlen = 0;
+  c->depth = depth;
+  c->head = 0;
+  c->count = 0;
+  c->inflight = (pending *)calloc(depth, sizeof(*c->inflight));
+  return c->inflight ? 0 : -1;
+}
+
+static void conn_close(conn *c) {
+  if (c->fd >= 0) {
+    close(c->fd);
+  }
+  c->fd = -1;
+  c->rpos = 0;
+  c->rlen = 0;
+  c->head = 0;
+  c->count = 0;
+}
+
+static void conn_free(conn *c) {
+  conn_close(c);
+  free(c->inflight);
+  c->inflight = NULL;
+}
+
+// Refills the read buffer. Returns -1 on error, timeout or EOF.
+static int conn_fill(conn *c) {
+  for (;;) {
+    ssize_t r = read(c->fd, c->rbuf, sizeof(c->rbuf));
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (r == 0) {
+      return -1;
+    }
+    c->rpos = 0;
+    c->rlen = (size_t)r;
+    return 0;
+  }
+}
+
+// Reads one "<len>:<payload>" reply. The payload is copied into reply_buf
+// (truncated to reply_cap - 1 bytes); reply_buf may be NULL to discard it.
+static int recv_reply(conn *c, char *reply_buf, size_t reply_cap) {
+  size_t len = 0;
+  size_t off = 0;
+  int digits = 0;
+
+  for (;;) {
+    char ch;
+    if (c->rpos == c->rlen && conn_fill(c) < 0) {
+      return -1;
+    }
+    ch = c->rbuf[c->rpos++];
+    if (ch == ':') {
+      break;
+    }
+    if (ch < '0' || ch > '9' || ++digits > 19) {
+      return -1;
+    }
+    len = len * 10 + (size_t)(ch - '0');
+  }
+
+  while (off < len) {
+    size_t avail;
+    size_t take;
+    if (c->rpos == c->rlen && conn_fill(c) < 0) {
+      return -1;
+    }
+    avail = c->rlen - c->rpos;
+    take = len - off < avail ? len - off : avail;
+    if (reply_buf && off < reply_cap - 1) {
+      size_t copy = take;
+      if (copy > reply_cap - 1 - off) {
+        copy = reply_cap - 1 - off;
+      }
+      memcpy(reply_buf + off, c->rbuf + c->rpos, copy);
+    }
+    c->rpos += take;
+    off += take;
+  }
+
+  if (reply_buf) {
+    reply_buf[len < reply_cap - 1 ? len : reply_cap - 1] = '\0';
+  }
+  return 0;
+}
+
+// Sends one request without waiting for the reply. Persistent connections are
+// (re)opened lazily.
+static int conn_send(conn *c, const char *hdr, size_t hdr_len,
+                     const char *body, size_t body_len) {
+  if (c->fd < 0) {
+    c->fd = connect_to(c->host, c->port);
+    if (c->fd < 0) {
+      return -1;
+    }
+  }
+
+  if (send_frame(c->fd, hdr, hdr_len, body, body_len) < 0) {
+    conn_close(c);
     return -1;
   }
+  return 0;
+}
 
-  fd = connect_to(host, port);
-  if (fd < 0) {
+static int send_request(conn *c, const char *body) {
+  char hdr[32];
+  size_t body_len = strlen(body);
+  int n = snprintf(hdr, sizeof(hdr), "%zu:", body_len);
+
+  return conn_send(c, hdr, (size_t)n, body, body_len);
+}
+
+// Sends a request already framed as "<len>:<body>".
+static int send_encoded(conn *c, const char *frame, size_t len) {
+  return conn_send(c, frame, len, NULL, 0);
+}
+
+static int await_reply(conn *c, char *reply_buf, size_t reply_cap) {
+  if (recv_reply(c, reply_buf, reply_cap) < 0) {
+    conn_close(c);
     return -1;
   }
 
-  if (send_all(fd, packet, (size_t)n) < 0) {
-    close(fd);
+  if (c->mode == CONN_CHURN) {
+    conn_close(c);
+  }
+  return 0;
+}
+
+// Replay traces, as written by the server's capture option. A trace file is
+// a 16-byte header ("BCTRACE" NUL, then little-endian u32 version and u32
+// reserved) followed by little-endian records of
+//
+//   u64 ts_ns, u32 value_size, u8 op, u8 key_len, key_len bytes of key
+//
+// with op one of TRACE_GET, TRACE_SET, TRACE_DEL.
+#define TRACE_MAGIC "BCTRACE"
+#define TRACE_VERSION 1
+#define TRACE_GET 0
+#define TRACE_SET 1
+#define TRACE_DEL 2
+#define TRACE_REC_FIXED 14 // record bytes before the key
+
+typedef struct {
+  uint64_t ts_ns; // since the first record
+  uint32_t value_size;
+  uint8_t op;
+  const char *key; // NUL-terminated, inside trace.keys
+  size_t key_off;  // offset of key in trace.keys while loading
+} trace_rec;
+
+typedef struct {
+  trace_rec *recs;
+  size_t n;
+  char *keys;       // key_len + 1 bytes per record
+  size_t max_value; // largest value_size seen
+} trace;
+
+static uint64_t get_le(const unsigned char *p, size_t n) {
+  uint64_t v = 0;
+  size_t i;
+  for (i = 0; i < n; i++) {
+    v |= (uint64_t)p[i] << (8 * i);
+  }
+  return v;
+}
+
+static int trace_load(trace *t, const char *path) {
+  FILE *fp = fopen(path, "rb");
+  char hdr[16];
+  uint32_t version;
+  size_t cap = 0, keys_len = 0, keys_cap = 0;
+  uint64_t first_ns = 0;
+  size_t i;
+
+  memset(t, 0, sizeof(*t));
+  if (!fp) {
+    perror(path);
+    return -1;
+  }
+  if (fread(hdr, sizeof(hdr), 1, fp) != 1 ||
+      memcmp(hdr, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+    fprintf(stderr, "%s: not a benchcached trace\n", path);
+    fclose(fp);
+    return -1;
+  }
+  version = (uint32_t)get_le((const unsigned char *)hdr + 8, 4);
+  if (version != TRACE_VERSION) {
+    fprintf(stderr, "%s: unsupported trace version %u\n", path, version);
+    fclose(fp);
     return -1;
   }
 
-  if (want_reply) {
-    struct timeval tv = {.tv_sec = 0, .tv_usec = 200000};
-    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-      close(fd);
+  for (;;) {
+    unsigned char fixed[TRACE_REC_FIXED];
+    uint64_t ts;
+    uint32_t size;
+    uint8_t op, len;
+    size_t got = fread(fixed, 1, sizeof(fixed), fp);
+    trace_rec *r;
+
+    if (got == 0) {
+      break;
+    }
+    ts = get_le(fixed, 8);
+    size = (uint32_t)get_le(fixed + 8, 4);
+    op = fixed[12];
+    len = fixed[13];
+    if (got != sizeof(fixed) || op > TRACE_DEL || size > VALUE_SIZE_MAX) {
+      fprintf(stderr, "%s: truncated or corrupt record %zu\n", path, t->n);
+      fclose(fp);
       return -1;
     }
-
-    ssize_t r = read(fd, reply_buf, reply_cap - 1);
-    if (r < 0) {
-      if (errno == EWOULDBLOCK || errno == EAGAIN) {
-        reply_buf[0] = '\0';
-      } else {
-        close(fd);
+    if (t->n == cap) {
+      cap = cap ? cap * 2 : 1024;
+      t->recs = (trace_rec *)realloc(t->recs, cap * sizeof(*t->recs));
+      if (!t->recs) {
+        fclose(fp);
         return -1;
       }
-    } else if (r == 0) {
-      reply_buf[0] = '\0';
-    } else {
-      reply_buf[r] = '\0';
+    }
+    if (keys_len + len + 1 > keys_cap) {
+      keys_cap = keys_cap ? keys_cap * 2 : 16384;
+      t->keys = (char *)realloc(t->keys, keys_cap);
+      if (!t->keys) {
+        fclose(fp);
+        return -1;
+      }
+    }
+    if (len && fread(t->keys + keys_len, len, 1, fp) != 1) {
+      fprintf(stderr, "%s: truncated record %zu\n", path, t->n);
+      fclose(fp);
+      return -1;
+    }
+    t->keys[keys_len + len] = '\0';
+
+    // Replay starts with the first request, not when capture began.
+    if (t->n == 0) {
+      first_ns = ts;
+    }
+    r = &t->recs[t->n++];
+    r->ts_ns = ts > first_ns ? ts - first_ns : 0;
+    r->value_size = size;
+    r->op = op;
+    r->key_off = keys_len;
+    keys_len += (size_t)len + 1;
+    if (size > t->max_value) {
+      t->max_value = size;
     }
   }
+  fclose(fp);
 
-  close(fd);
-  return 0;
+  // keys may have moved while growing; resolve offsets now.
+  for (i = 0; i < t->n; i++) {
+    t->recs[i].key = t->keys + t->recs[i].key_off;
+  }
+  return t->n ? 0 : -1;
 }
 
-static void record(metric *m, uint64_t elapsed_ns) {
-  m->count++;
-  m->total_ns += elapsed_ns;
+static void trace_free(trace *t) {
+  free(t->recs);
+  free(t->keys);
+  memset(t, 0, sizeof(*t));
 }
 
-int main(int argc, char *argv[]) {
+typedef enum {
+  ENGINE_SYNC,  // blocking sockets, one request at a time per thread
+  ENGINE_EPOLL, // non-blocking sockets multiplexed with epoll
+} engine_kind;
+
+typedef enum {
+  ARRIVAL_FIXED,   // evenly spaced sends
+  ARRIVAL_POISSON, // exponential inter-arrival gaps
+} arrival_mode;
+
+typedef struct {
   const char *host;
   int port;
   long requests;
   long keyspace;
-  long i;
-  metric get_m = {0, 0}, set_m = {0, 0}, del_m = {0, 0};
-  uint64_t start_ns, end_ns;
-  uint64_t failures = 0;
-  unsigned rng = 0x9e3779b9U;
+  long threads;
+  long conns_per_thread;
+  conn_mode mode;
+  double rate; // open-loop target ops/s over all threads; 0 = closed loop
+  arrival_mode arrival;
+  unsigned pipeline; // max requests in flight per connection
+  key_dist keys;
+  op_mix mix;
+  value_dist values;
+  size_t body_cap; // room for the largest set request
+  int engine;      // ENGINE_SYNC or ENGINE_EPOLL
+  const trace *replay; // replay this trace instead of generating ops
+  double speed;        // replay speed factor; 0 = as fast as possible
+  int open_loop;       // requests follow a schedule (rate or replay)
+  uint64_t interval_ns; // --interval snapshot period; 0 = off
+  uint64_t duration_ns; // --duration measured window; 0 = fixed count
+  uint64_t warmup_ns;   // unmeasured load before the window
+  uint64_t cooldown_ns; // unmeasured load after it
+  uint64_t window_ns;   // duration runs: start of the window
+  uint64_t end_ns;      // duration runs: stop issuing at this time
+  long warmup_threads;  // connections populating the keyspace
+  int co_correct;          // --co-correct: also keep corrected histograms
+  uint64_t co_interval_ns; // intended gap between a connection's sends
+  int pregen;           // encode every request before the clock starts
+  int perf;             // count hardware events in every worker
+  int verify;           // check replies against shadow
+  shadow_entry *shadow; // --verify: keyspace entries
+  pthread_barrier_t *barrier; // workers connect, then wait for start_ns
+  uint64_t start_ns;
+} client_config;
 
-  if (argc != 5) {
-    usage(argv[0]);
-    return 1;
+// Draws the next operation from the workload, as the standalone benchmark
+// would from the same seed.
+static void next_op(const client_config *cfg, unsigned *rng, uint64_t *latest,
+                    pending *d) {
+  request r;
+
+  workload_next(&r, &cfg->mix, &cfg->keys, &cfg->values, rng, latest);
+  d->op = r.op;
+  d->key_id = r.key_id;
+  d->seed = r.seed;
+  d->size = r.size;
+  d->step = 0;
+  d->steps = r.steps;
+  d->key = NULL;
+}
+
+// Builds the body of request number `step` of op d. val is scratch space of
+// cfg->body_cap bytes, body must hold cfg->body_cap bytes.
+static void format_step(const client_config *cfg, const pending *d,
+                        uint32_t step, char *val, char *body) {
+  char key_buf[KEY_MAX];
+  const char *key = d->key;
+
+  if (!key) {
+    uint32_t key_id = d->key_id;
+    if (d->op == OP_SCAN) {
+      key_id = (key_id + step) % (uint32_t)cfg->keyspace;
+    }
+    snprintf(key_buf, sizeof(key_buf), "k%u", key_id);
+    key = key_buf;
   }
 
-  host = argv[1];
-  port = atoi(argv[2]);
-  requests = atol(argv[3]);
-  keyspace = atol(argv[4]);
+  if (d->op == OP_SET || (d->op == OP_RMW && step == 1)) {
+    make_value(val, d->seed, d->size);
+    snprintf(body, cfg->body_cap, "set:%s:%s", key, val);
+  } else if (d->op == OP_DEL) {
+    snprintf(body, cfg->body_cap, "del:%s", key);
+  } else {
+    snprintf(body, cfg->body_cap, "get:%s", key);
+  }
+}
 
-  if (port <= 0 || requests <= 0 || keyspace <= 0) {
-    usage(argv[0]);
-    return 1;
+// Non-blocking connection driven by the epoll engine. Requests are queued in
+// wbuf and replies are parsed incrementally as bytes arrive.
+typedef struct {
+  int fd;
+  int connected;
+  pending *inflight; // FIFO of outstanding requests, cfg->pipeline long
+  unsigned head;
+  unsigned count;
+  char *wbuf;
+  size_t wpos;
+  size_t wlen;
+  size_t wcap;
+  size_t reply_len; // length header parsed so far
+  size_t reply_left; // payload bytes still to skip
+  int in_payload;
+} aconn;
+
+// --pregen: one op of a worker's pre-generated stream. Its requests are
+// frames first .. first + d.steps - 1 of the worker's arena.
+typedef struct {
+  pending d;
+  size_t first;
+} pregen_op;
+
+// Per-thread state. Each worker owns its connections and metrics, so the
+// timed loop never touches shared data; results are merged after join.
+typedef struct {
+  const client_config *cfg;
+  pthread_t tid;
+  long id;
+  conn *conns;
+  aconn *aconns; // epoll engine connections
+  int epfd;
+  int tfd;       // epoll engine: open-loop timer
+  long live;     // epoll engine: connections still usable
+  long issued;   // ops started
+  long done;     // epoll engine: ops finished or failed
+  unsigned rr;   // epoll engine: next connection for open-loop dispatch
+  double carry;  // open loop: fractional ns carried between gaps
+  size_t trace_pos; // replay: index of this thread's next record
+  long requests;
+  unsigned rng;
+  unsigned arr_rng;  // separate stream so arrivals don't perturb the op mix
+  uint64_t next_ns;  // open loop: intended send time of the next request
+  double gap_ns;     // open loop: mean gap between this thread's requests
+  uint64_t latest;   // KEYS_LATEST insert counter
+  uint64_t late;     // open loop: requests sent after their intended time
+  metric m[OP_COUNT];
+  pthread_mutex_t iv_lock; // guards iv against the interval reporter
+  metric iv[OP_COUNT];     // --interval: ops since the last snapshot
+  metric co[OP_COUNT];     // --co-correct: m with omitted sends back-filled
+  uint64_t failures;
+  uint64_t verified;   // --verify: get replies checked
+  uint64_t mismatches; // value neither expected nor the previous one
+  uint64_t stale;      // previous value of the key
+  uint64_t misses;     // empty reply for a key that should exist
+  char *val;      // body_cap bytes each
+  char *body;
+  char *set_body;
+  char *reply;    // --verify: get replies
+  pregen_op *pg_ops;  // --pregen: the ops, w->requests of them
+  size_t *pg_frames;  // arena offset of every frame, plus the end
+  char *pg_arena;     // the frames back to back
+  size_t pg_bytes;
+  struct pollfd *pfds; // one per connection, for waiting on replies
+  char *rbuf;          // epoll engine: shared read buffer
+  perf_set ps;         // --perf: this thread's counters, over its run
+  perf_counts perf;
+} worker;
+
+// Duration runs stop issuing once the cool-down is over.
+static int run_over(const client_config *cfg, uint64_t t_ns) {
+  return cfg->end_ns && t_ns >= cfg->end_ns;
+}
+
+// Records an op sent (or due) at t0 and answered at t1. Duration runs only
+// count ops sent inside the measurement window; interval reports see all.
+static void worker_record(worker *w, op_kind op, uint64_t t0, uint64_t t1) {
+  const client_config *cfg = w->cfg;
+
+  if (!cfg->duration_ns ||
+      (t0 >= cfg->window_ns && t0 - cfg->window_ns < cfg->duration_ns)) {
+    record(&w->m[op], t1 - t0);
+    if (cfg->co_correct) {
+      record_corrected(&w->co[op], t1 - t0, cfg->co_interval_ns);
+    }
   }
+  if (cfg->interval_ns) {
+    pthread_mutex_lock(&w->iv_lock);
+    record(&w->iv[op], t1 - t0);
+    pthread_mutex_unlock(&w->iv_lock);
+  }
+}
+
+// Verification (--verify). The client keeps the value it expects for every
+// key and checks each get reply against it. Keys are partitioned by
+// connection (key_id modulo the connection count), so all requests for a key
+// go over one connection, in order, and the expected value is exact.
+static void verify_partition(const client_config *cfg, pending *d,
+                             uint32_t part) {
+  uint32_t parts = (uint32_t)(cfg->threads * cfg->conns_per_thread);
+  d->key_id = d->key_id - d->key_id % parts + part;
+  if (d->key_id >= (uint32_t)cfg->keyspace) {
+    d->key_id -= parts;
+  }
+}
+
+static uint32_t verify_key(const client_config *cfg, const pending *d,
+                           uint32_t step) {
+  if (d->op == OP_SCAN) {
+    return (d->key_id + step) % (uint32_t)cfg->keyspace;
+  }
+  return d->key_id;
+}
 
-  printf("Target: %s:%d\n", host, port);
-  printf("Requests: %ld, Keyspace: %ld\n", requests, keyspace);
+// A write whose outcome is unknown (the connection broke) leaves the key
+// unchecked until the next write that succeeds.
+static void verify_forget(worker *w, const pending *d) {
+  const client_config *cfg = w->cfg;
+  if (cfg->verify && (d->op == OP_SET || d->op == OP_DEL || d->op == OP_RMW)) {
+    cfg->shadow[d->key_id].state = SHADOW_UNKNOWN;
+  }
+}
+
+static int shadow_matches(worker *w, const char *reply, size_t len,
+                          uint32_t seed, uint32_t size) {
+  return make_value(w->val, seed, size) == len &&
+         memcmp(w->val, reply, len) == 0;
+}
 
-  // Warm-up and populate keys so get has a hit rate.
-  for (i = 0; i < keyspace; i++) {
-    char key[KEY_MAX];
-    char val[VAL_MAX];
-    char body[BODY_MAX];
+// Applies the successful reply to request `step` of d: writes update the
+// shadow, reads are checked against it.
+static void verify_reply(worker *w, const pending *d, uint32_t step,
+                         const char *reply) {
+  const client_config *cfg = w->cfg;
+  uint32_t parts = (uint32_t)(cfg->threads * cfg->conns_per_thread);
+  uint32_t key;
+  shadow_entry *e;
+  size_t len;
 
-    snprintf(key, sizeof(key), "k%ld", i);
-    snprintf(val, sizeof(val), "v%ld", i);
-    snprintf(body, sizeof(body), "set:%s:%s", key, val);
+  if (!cfg->verify) {
+    return;
+  }
+  key = verify_key(cfg, d, step);
+  if (key % parts != d->key_id % parts) {
+    return; // scans cross into keys other connections own
+  }
+  e = &cfg->shadow[key];
+  if (d->op == OP_SET || d->op == OP_DEL || (d->op == OP_RMW && step == 1)) {
+    e->prev_state = e->state;
+    e->prev_seed = e->seed;
+    e->prev_size = e->size;
+    e->state = d->op == OP_DEL ? SHADOW_ABSENT : SHADOW_PRESENT;
+    e->seed = d->seed;
+    e->size = d->size;
+    return;
+  }
+  if (e->state == SHADOW_UNKNOWN) {
+    return;
+  }
 
-    if (send_cmd(host, port, body, 0, NULL, 0) < 0) {
-      failures++;
+  w->verified++;
+  len = strlen(reply);
+  if (len == 0) {
+    if (e->state == SHADOW_PRESENT) {
+      w->misses++;
     }
+  } else if (e->state == SHADOW_PRESENT &&
+             shadow_matches(w, reply, len, e->seed, e->size)) {
+    return;
+  } else if (e->prev_state == SHADOW_PRESENT &&
+             shadow_matches(w, reply, len, e->prev_seed, e->prev_size)) {
+    w->stale++;
+  } else {
+    w->mismatches++;
   }
+}
 
-  start_ns = now_ns();
+static void sleep_until(uint64_t t_ns) {
+  struct timespec ts;
+  ts.tv_sec = (time_t)(t_ns / 1000000000ULL);
+  ts.tv_nsec = (long)(t_ns % 1000000000ULL);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}
 
-  for (i = 0; i < requests; i++) {
-    uint32_t key_id;
-    uint32_t bucket;
-    char key[KEY_MAX];
-    char val[VAL_MAX];
-    char body[BODY_MAX];
-    char reply[REPLY_MAX];
-    uint64_t t0, t1;
+static double next_gap_ns(worker *w) {
+  double u;
+  if (w->cfg->arrival == ARRIVAL_FIXED) {
+    return w->gap_ns;
+  }
+  // Upper 24 bits of the LCG, mapped into (0, 1].
+  u = ((double)(lcg_next(&w->arr_rng) >> 8) + 1.0) / 16777216.0;
+  return -log(u) * w->gap_ns;
+}
 
-    // Tiny LCG for reproducible pseudo-random workload.
-    rng = rng * 1664525U + 1013904223U;
-    bucket = rng % 100;
+// Draws the next op for this worker, from the replay trace if there is one.
+// Replayed records are dealt to threads round-robin.
+static void draw_op(worker *w, unsigned *rng, pending *d) {
+  const client_config *cfg = w->cfg;
+  const trace_rec *r;
 
-    rng = rng * 1664525U + 1013904223U;
-    key_id = rng % (uint32_t)keyspace;
+  if (!cfg->replay) {
+    next_op(cfg, rng, &w->latest, d);
+    return;
+  }
 
-    snprintf(key, sizeof(key), "k%u", key_id);
+  r = &cfg->replay->recs[w->trace_pos];
+  d->op = r->op == TRACE_SET ? OP_SET : r->op == TRACE_DEL ? OP_DEL : OP_GET;
+  d->key = r->key;
+  d->key_id = 0;
+  d->seed = (uint32_t)w->trace_pos;
+  d->size = r->value_size;
+  d->step = 0;
+  d->steps = 1;
+  w->trace_pos += (size_t)cfg->threads;
+}
 
-    if (bucket < 70) {
-      snprintf(body, sizeof(body), "get:%s", key);
-      t0 = now_ns();
-      if (send_cmd(host, port, body, 1, reply, sizeof(reply)) < 0) {
-        failures++;
-      }
-      t1 = now_ns();
-      record(&get_m, t1 - t0);
-    } else if (bucket < 90) {
-      snprintf(val, sizeof(val), "v%u", key_id ^ rng);
-      snprintf(body, sizeof(body), "set:%s:%s", key, val);
-      t0 = now_ns();
-      if (send_cmd(host, port, body, 0, NULL, 0) < 0) {
-        failures++;
+// Open loop: sets next_ns to the intended send time of the next op, either
+// one inter-arrival gap later or the next replayed record's timestamp.
+static void schedule_next(worker *w) {
+  const client_config *cfg = w->cfg;
+  double gap;
+
+  if (cfg->replay) {
+    if (w->trace_pos < cfg->replay->n) {
+      w->next_ns = cfg->start_ns +
+                   (uint64_t)((double)cfg->replay->recs[w->trace_pos].ts_ns /
+                              cfg->speed);
+    }
+    return;
+  }
+  gap = next_gap_ns(w) + w->carry;
+  w->next_ns += (uint64_t)gap;
+  w->carry = gap - (double)(uint64_t)gap;
+}
+
+// Draws the worker's whole run and encodes every request as a frame in one
+// arena, so the timed loop in run_sync() only sends. Ops are drawn in the
+// order run_sync() would draw them and keep their connection, so --verify
+// partitions them the same way.
+static int worker_pregen(worker *w) {
+  const client_config *cfg = w->cfg;
+  size_t cap = 1 << 16;
+  size_t nframes = 0, frames_cap = 1024;
+  unsigned rng = w->rng;
+  long i;
+
+  w->pg_ops = (pregen_op *)malloc((size_t)w->requests * sizeof(*w->pg_ops));
+  w->pg_frames = (size_t *)malloc(frames_cap * sizeof(*w->pg_frames));
+  w->pg_arena = (char *)malloc(cap);
+  if (!w->pg_ops || !w->pg_frames || !w->pg_arena) {
+    return -1;
+  }
+  w->pg_bytes = 0;
+
+  for (i = 0; i < w->requests; i++) {
+    pregen_op *p = &w->pg_ops[i];
+    uint32_t k;
+
+    draw_op(w, &rng, &p->d);
+    if (cfg->verify) {
+      verify_partition(cfg, &p->d,
+                       (uint32_t)(w->id * cfg->conns_per_thread +
+                                  i % cfg->conns_per_thread));
+    }
+    p->first = nframes;
+    for (k = 0; k < p->d.steps; k++) {
+      size_t len;
+      int n;
+
+      format_step(cfg, &p->d, k, w->val, w->body);
+      len = strlen(w->body);
+      while (w->pg_bytes + len + 32 > cap) {
+        char *grown = (char *)realloc(w->pg_arena, cap * 2);
+        if (!grown) {
+          return -1;
+        }
+        w->pg_arena = grown;
+        cap *= 2;
       }
-      t1 = now_ns();
-      record(&set_m, t1 - t0);
-    } else {
-      snprintf(body, sizeof(body), "del:%s", key);
-      t0 = now_ns();
-      if (send_cmd(host, port, body, 0, NULL, 0) < 0) {
-        failures++;
+      // One slot spare for the end offset.
+      if (nframes + 1 == frames_cap) {
+        size_t *grown = (size_t *)realloc(
+            w->pg_frames, frames_cap * 2 * sizeof(*w->pg_frames));
+        if (!grown) {
+          return -1;
+        }
+        w->pg_frames = grown;
+        frames_cap *= 2;
       }
-      t1 = now_ns();
-      record(&del_m, t1 - t0);
+      w->pg_frames[nframes++] = w->pg_bytes;
+      n = snprintf(w->pg_arena + w->pg_bytes, 32, "%zu:", len);
+      memcpy(w->pg_arena + w->pg_bytes + n, w->body, len);
+      w->pg_bytes += (size_t)n + len;
     }
   }
+  w->pg_frames[nframes] = w->pg_bytes;
+  w->rng = rng;
+  return 0;
+}
 
-  end_ns = now_ns();
+// Sends request `frame` of the pre-generated stream, or body without one.
+static int sync_send(worker *w, conn *c, const char *body, size_t frame) {
+  if (w->pg_arena) {
+    return send_encoded(c, w->pg_arena + w->pg_frames[frame],
+                        w->pg_frames[frame + 1] - w->pg_frames[frame]);
+  }
+  return send_request(c, body);
+}
 
-  {
-    uint64_t total_ns = end_ns - start_ns;
-    double seconds = (double)total_ns / 1e9;
-    double rps = (double)requests / seconds;
+// Sends one request and waits for its reply. Connections are dropped on any
+// error so the next request starts on a clean stream.
+static int sync_cmd(worker *w, conn *c, const char *body, size_t frame,
+                    char *reply_buf, size_t reply_cap) {
+  if (sync_send(w, c, body, frame) < 0) {
+    return -1;
+  }
+  return await_reply(c, reply_buf, reply_cap);
+}
 
-    printf("\nResults\n");
-    printf("  Total time: %.3f s\n", seconds);
-    printf("  Throughput: %.0f ops/s\n", rps);
-    printf("  Failures: %llu\n", (unsigned long long)failures);
+// Runs the scan's gets one after another on c, formatting each into
+// w->body.
+static int send_scan(worker *w, conn *c, const pending *d, size_t first) {
+  const client_config *cfg = w->cfg;
+  char *body = w->body;
+  char buf[REPLY_MAX];
+  char *reply = cfg->verify ? w->reply : buf;
+  size_t cap = cfg->verify ? cfg->body_cap : sizeof(buf);
+  uint32_t k;
+
+  for (k = 0; k < d->steps; k++) {
+    if (!w->pg_arena) {
+      format_step(cfg, d, k, NULL, body);
+    }
+    if (sync_cmd(w, c, body, first + k, reply, cap) < 0) {
+      return -1;
+    }
+    verify_reply(w, d, k, reply);
+  }
+  return 0;
+}
+
+// The connection broke with count requests in flight from head on.
+static void verify_lost(worker *w, const conn *c, unsigned head,
+                        unsigned count) {
+  unsigned k;
+  for (k = 0; k < count; k++) {
+    verify_forget(w, &c->inflight[(head + k) % c->depth]);
+  }
+}
 
-    if (get_m.count) {
-      printf("  GET avg: %.3f us (%llu ops)\n",
-             ((double)get_m.total_ns / (double)get_m.count) / 1e3,
-             (unsigned long long)get_m.count);
+// Reads the oldest outstanding reply on a pipelined connection and records
+// its latency. If the stream breaks, everything in flight counts as failed.
+static void complete_one(worker *w, conn *c) {
+  pending *p = &c->inflight[c->head];
+  char *reply = w->cfg->verify ? w->reply : NULL;
+
+  if (recv_reply(c, reply, w->cfg->body_cap) < 0) {
+    w->failures += c->count;
+    verify_lost(w, c, c->head, c->count);
+    conn_close(c);
+    return;
+  }
+  verify_reply(w, p, 0, reply);
+  worker_record(w, p->op, p->t0, now_ns());
+  c->head = (c->head + 1) % c->depth;
+  c->count--;
+}
+
+static void drain(worker *w, conn *c) {
+  while (c->count) {
+    complete_one(w, c);
+  }
+}
+
+// Waits for t_ns while collecting pipelined replies as they arrive, so a
+// reply isn't charged for time it spent unread in the socket buffer.
+static void wait_until(worker *w, uint64_t t_ns) {
+  const client_config *cfg = w->cfg;
+
+  for (;;) {
+    uint64_t now = now_ns();
+    struct timespec ts;
+    nfds_t n = 0;
+    long j;
+    int ready;
+
+    if (now >= t_ns) {
+      return;
+    }
+    for (j = 0; j < cfg->conns_per_thread; j++) {
+      conn *c = &w->conns[j];
+      if (c->count == 0) {
+        continue;
+      }
+      if (c->rpos < c->rlen) {
+        complete_one(w, c);
+        n = 0;
+        break;
+      }
+      w->pfds[n].fd = c->fd;
+      w->pfds[n].events = POLLIN;
+      n++;
+    }
+    if (j < cfg->conns_per_thread) {
+      continue; // consumed a buffered reply; rescan
     }
-    if (set_m.count) {
-      printf("  SET avg: %.3f us (%llu ops)\n",
-             ((double)set_m.total_ns / (double)set_m.count) / 1e3,
-             (unsigned long long)set_m.count);
+    if (n == 0) {
+      sleep_until(t_ns);
+      return;
+    }
+
+    ts.tv_sec = (time_t)((t_ns - now) / 1000000000ULL);
+    ts.tv_nsec = (long)((t_ns - now) % 1000000000ULL);
+    ready = ppoll(w->pfds, n, &ts, NULL);
+    if (ready <= 0) {
+      continue;
     }
-    if (del_m.count) {
-      printf("  DEL avg: %.3f us (%llu ops)\n",
-             ((double)del_m.total_ns / (double)del_m.count) / 1e3,
-             (unsigned long long)del_m.count);
+    for (j = 0; j < cfg->conns_per_thread; j++) {
+      conn *c = &w->conns[j];
+      nfds_t k;
+      if (c->count == 0) {
+        continue;
+      }
+      for (k = 0; k < n; k++) {
+        if (w->pfds[k].fd == c->fd && w->pfds[k].revents) {
+          complete_one(w, c);
+          break;
+        }
+      }
     }
   }
+}
+
+static void run_sync(worker *w) {
+  const client_config *cfg = w->cfg;
+  unsigned rng = w->rng;
+  long i;
+
+  for (i = 0; i < w->requests; i++) {
+    pending d;
+    size_t first = 0; // --pregen: the op's first frame
+    op_kind op;
+    char *body = w->body;
+    char *set_body = w->set_body;
+    char buf[REPLY_MAX];
+    char *reply = cfg->verify ? w->reply : buf;
+    size_t cap = cfg->verify ? cfg->body_cap : sizeof(buf);
+    long part = i % cfg->conns_per_thread;
+    conn *c = &w->conns[part];
+    int pipelined;
+    int rc;
+    uint64_t t0, t1;
+
+    if (cfg->end_ns &&
+        run_over(cfg, cfg->open_loop ? w->next_ns : now_ns())) {
+      break;
+    }
+    if (w->pg_ops) {
+      d = w->pg_ops[i].d;
+      first = w->pg_ops[i].first;
+    } else {
+      draw_op(w, &rng, &d);
+      if (cfg->verify) {
+        verify_partition(cfg, &d,
+                         (uint32_t)(w->id * cfg->conns_per_thread + part));
+      }
+      if (d.op != OP_SCAN) {
+        format_step(cfg, &d, 0, w->val, body);
+      }
+      if (d.op == OP_RMW) {
+        format_step(cfg, &d, 1, w->val, set_body);
+      }
+    }
+    op = (op_kind)d.op;
+
+    // Only single-request ops are pipelined; scan and rmw run on a drained
+    // connection since each step depends on the previous reply.
+    pipelined = cfg->pipeline > 1 && op != OP_SCAN && op != OP_RMW;
+    if (cfg->pipeline > 1) {
+      if (!pipelined) {
+        drain(w, c);
+      } else if (c->count == c->depth) {
+        complete_one(w, c);
+      }
+    }
+
+    if (cfg->open_loop) {
+      // Open loop: latency counts from the intended send time, so time spent
+      // queued behind a slow reply is charged to the request that waited.
+      t0 = w->next_ns;
+      if (now_ns() < t0) {
+        wait_until(w, t0);
+      } else {
+        w->late++;
+      }
+      schedule_next(w);
+    } else {
+      t0 = now_ns();
+    }
 
-  return failures == 0 ? 0 : 2;
+    if (pipelined) {
+      unsigned head = c->head;
+      unsigned lost = c->count;
+      if (sync_send(w, c, body, first) < 0) {
+        w->failures += lost + 1;
+        verify_lost(w, c, head, lost);
+        verify_forget(w, &d);
+      } else {
+        d.t0 = t0;
+        c->inflight[(c->head + c->count) % c->depth] = d;
+        c->count++;
+      }
+      continue;
+    }
+
+    switch (op) {
+    case OP_GET:
+      rc = sync_cmd(w, c, body, first, reply, cap);
+      if (rc == 0) {
+        verify_reply(w, &d, 0, reply);
+      }
+      break;
+    case OP_SCAN:
+      rc = send_scan(w, c, &d, first);
+      break;
+    case OP_RMW:
+      rc = sync_cmd(w, c, body, first, reply, cap);
+      if (rc == 0) {
+        verify_reply(w, &d, 0, reply);
+        rc = sync_cmd(w, c, set_body, first + 1, NULL, 0);
+      }
+      if (rc == 0) {
+        verify_reply(w, &d, 1, NULL);
+      }
+      break;
+    default:
+      rc = sync_cmd(w, c, body, first, NULL, 0);
+      if (rc == 0) {
+        verify_reply(w, &d, 0, NULL);
+      }
+      break;
+    }
+    if (rc < 0) {
+      w->failures++;
+      verify_forget(w, &d);
+    }
+    t1 = now_ns();
+    worker_record(w, op, t0, t1);
+  }
+
+  w->issued = i;
+
+  for (i = 0; i < cfg->conns_per_thread; i++) {
+    drain(w, &w->conns[i]);
+  }
+
+  w->rng = rng;
+}
+
+// ---------------------------------------------------------------------------
+// epoll engine: every thread multiplexes its connections without blocking,
+// so a handful of threads can hold tens of thousands of connections open.
+// ---------------------------------------------------------------------------
+
+// Queues one framed request for writing.
+static int aconn_queue(aconn *a, const char *body) {
+  size_t body_len = strlen(body);
+  size_t need = a->wlen + body_len + 32;
+
+  if (need > a->wcap) {
+    size_t cap = a->wcap ? a->wcap : 256;
+    char *p;
+    while (cap < need) {
+      cap *= 2;
+    }
+    p = (char *)realloc(a->wbuf, cap);
+    if (!p) {
+      return -1;
+    }
+    a->wbuf = p;
+    a->wcap = cap;
+  }
+  a->wlen += (size_t)sprintf(a->wbuf + a->wlen, "%zu:", body_len);
+  memcpy(a->wbuf + a->wlen, body, body_len);
+  a->wlen += body_len;
+  return 0;
+}
+
+// Writes as much queued data as the socket takes.
+static int aconn_flush(aconn *a) {
+  while (a->wpos < a->wlen) {
+    ssize_t w = write(a->fd, a->wbuf + a->wpos, a->wlen - a->wpos);
+    if (w < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      return -1;
+    }
+    a->wpos += (size_t)w;
+  }
+  a->wpos = 0;
+  a->wlen = 0;
+  return 0;
+}
+
+static void aconn_fail(worker *w, aconn *a) {
+  if (a->fd < 0) {
+    return;
+  }
+  w->failures += a->count;
+  w->done += a->count;
+  a->head = 0;
+  a->count = 0;
+  close(a->fd);
+  a->fd = -1;
+  w->live--;
+}
+
+// Appends op d (at its current step) to the connection's FIFO and queues
+// the matching request.
+static void aconn_push(worker *w, aconn *a, const pending *d) {
+  const client_config *cfg = w->cfg;
+
+  format_step(cfg, d, d->step, w->val, w->body);
+  a->inflight[(a->head + a->count) % cfg->pipeline] = *d;
+  a->count++;
+  if (aconn_queue(a, w->body) < 0) {
+    aconn_fail(w, a);
+  }
+}
+
+static void aconn_start(worker *w, aconn *a, uint64_t t0) {
+  pending d;
+  draw_op(w, &w->rng, &d);
+  d.t0 = t0;
+  w->issued++;
+  aconn_push(w, a, &d);
+}
+
+// Closed loop: keep the connection's window full while work remains.
+static void aconn_fill(worker *w, aconn *a) {
+  while (a->fd >= 0 && a->count < w->cfg->pipeline &&
+         w->issued < w->requests) {
+    uint64_t now = now_ns();
+    if (run_over(w->cfg, now)) {
+      w->requests = w->issued;
+      break;
+    }
+    aconn_start(w, a, now);
+  }
+}
+
+// Handles a complete reply: either advances a multi-request op or records
+// the op's latency.
+static void aconn_reply(worker *w, aconn *a) {
+  pending d = a->inflight[a->head];
+
+  a->head = (a->head + 1) % w->cfg->pipeline;
+  a->count--;
+  if (++d.step < d.steps) {
+    aconn_push(w, a, &d);
+    return;
+  }
+  worker_record(w, d.op, d.t0, now_ns());
+  w->done++;
+  if (!w->cfg->open_loop) {
+    aconn_fill(w, a);
+  }
+}
+
+// Reads everything available and parses "<len>:<payload>" replies.
+static int aconn_read(worker *w, aconn *a) {
+  for (;;) {
+    ssize_t r = read(a->fd, w->rbuf, RBUF_SIZE * 16);
+    size_t pos = 0;
+
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    if (r == 0) {
+      return -1;
+    }
+
+    while (pos < (size_t)r) {
+      if (a->in_payload) {
+        size_t take = (size_t)r - pos;
+        if (take > a->reply_left) {
+          take = a->reply_left;
+        }
+        pos += take;
+        a->reply_left -= take;
+      } else {
+        char ch = w->rbuf[pos++];
+        if (ch != ':') {
+          if (ch < '0' || ch > '9') {
+            return -1;
+          }
+          a->reply_len = a->reply_len * 10 + (size_t)(ch - '0');
+          continue;
+        }
+        a->in_payload = 1;
+        a->reply_left = a->reply_len;
+        a->reply_len = 0;
+      }
+      if (a->in_payload && a->reply_left == 0) {
+        a->in_payload = 0;
+        if (a->count == 0) {
+          return -1; // reply nobody asked for
+        }
+        aconn_reply(w, a);
+        if (a->fd < 0) {
+          return 0;
+        }
+      }
+    }
+  }
+}
+
+// Starts a non-blocking connect and registers the socket.
+static int aconn_open(worker *w, aconn *a) {
+  const client_config *cfg = w->cfg;
+  struct sockaddr_in addr;
+  struct epoll_event ev;
+  int one = 1;
+
+  a->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (a->fd < 0) {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)cfg->port);
+  if (inet_pton(AF_INET, cfg->host, &addr.sin_addr) != 1 ||
+      setsockopt(a->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0 ||
+      (connect(a->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 &&
+       errno != EINPROGRESS)) {
+    close(a->fd);
+    a->fd = -1;
+    return -1;
+  }
+
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  ev.data.ptr = a;
+  if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, a->fd, &ev) < 0) {
+    close(a->fd);
+    a->fd = -1;
+    return -1;
+  }
+  w->live++;
+  return 0;
+}
+
+static void aconn_event(worker *w, aconn *a, uint32_t events) {
+  if (!a->connected) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if ((events & (EPOLLERR | EPOLLHUP)) ||
+        getsockopt(a->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+      aconn_fail(w, a);
+      return;
+    }
+    if (!(events & EPOLLOUT)) {
+      return;
+    }
+    a->connected = 1;
+  }
+  if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && aconn_read(w, a) < 0) {
+    aconn_fail(w, a);
+    return;
+  }
+  if (a->fd >= 0 && a->wlen && aconn_flush(a) < 0) {
+    aconn_fail(w, a);
+  }
+}
+
+// Opens every connection and waits until each is established or failed.
+static int async_prepare(worker *w) {
+  const client_config *cfg = w->cfg;
+  struct epoll_event events[MAX_EVENTS];
+  uint64_t deadline = now_ns() + CONNECT_TIMEOUT_NS;
+  long pending_conns = 0;
+  long j;
+
+  w->epfd = epoll_create1(0);
+  w->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (w->epfd < 0 || w->tfd < 0) {
+    return -1;
+  }
+  {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // the timer
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->tfd, &ev) < 0) {
+      return -1;
+    }
+  }
+
+  for (j = 0; j < cfg->conns_per_thread; j++) {
+    aconn *a = &w->aconns[j];
+    a->fd = -1;
+    a->inflight = (pending *)calloc(cfg->pipeline, sizeof(*a->inflight));
+    if (!a->inflight) {
+      return -1;
+    }
+    if (aconn_open(w, a) < 0) {
+      w->failures++;
+    }
+  }
+
+  do {
+    int n = epoll_wait(w->epfd, events, MAX_EVENTS, 100);
+    int k;
+    for (k = 0; k < n; k++) {
+      if (events[k].data.ptr) {
+        aconn_event(w, (aconn *)events[k].data.ptr, events[k].events);
+      }
+    }
+    pending_conns = 0;
+    for (j = 0; j < cfg->conns_per_thread; j++) {
+      pending_conns += w->aconns[j].fd >= 0 && !w->aconns[j].connected;
+    }
+  } while (pending_conns && now_ns() < deadline);
+
+  for (j = 0; j < cfg->conns_per_thread; j++) {
+    if (w->aconns[j].fd >= 0 && !w->aconns[j].connected) {
+      aconn_fail(w, &w->aconns[j]);
+    }
+  }
+  return 0;
+}
+
+// Open loop: issue every op whose intended time has come on a connection
+// with room in its window, then arm the timer for the next one.
+static void async_dispatch(worker *w) {
+  const client_config *cfg = w->cfg;
+  uint64_t now = now_ns();
+  struct itimerspec its;
+
+  while (w->issued < w->requests && w->next_ns <= now) {
+    aconn *a = NULL;
+    long tries;
+
+    if (run_over(cfg, w->next_ns)) {
+      w->requests = w->issued;
+      break;
+    }
+    for (tries = 0; tries < cfg->conns_per_thread; tries++) {
+      aconn *cand = &w->aconns[w->rr];
+      w->rr = (w->rr + 1) % (unsigned)cfg->conns_per_thread;
+      if (cand->fd >= 0 && cand->count < cfg->pipeline) {
+        a = cand;
+        break;
+      }
+    }
+    if (!a) {
+      break; // every window is full; a reply will call us again
+    }
+    if (now - w->next_ns > LATE_SLACK_NS) {
+      w->late++;
+    }
+    aconn_start(w, a, w->next_ns);
+    if (a->fd >= 0 && aconn_flush(a) < 0) {
+      aconn_fail(w, a);
+    }
+    schedule_next(w);
+  }
+
+  memset(&its, 0, sizeof(its));
+  if (w->issued < w->requests && w->next_ns > now) {
+    its.it_value.tv_sec = (time_t)(w->next_ns / 1000000000ULL);
+    its.it_value.tv_nsec = (long)(w->next_ns % 1000000000ULL);
+    timerfd_settime(w->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+  }
+}
+
+static void run_async(worker *w) {
+  const client_config *cfg = w->cfg;
+  struct epoll_event events[MAX_EVENTS];
+  long j;
+
+  if (cfg->open_loop) {
+    async_dispatch(w);
+  } else {
+    for (j = 0; j < cfg->conns_per_thread; j++) {
+      aconn *a = &w->aconns[j];
+      aconn_fill(w, a);
+      if (a->fd >= 0 && aconn_flush(a) < 0) {
+        aconn_fail(w, a);
+      }
+    }
+  }
+
+  while (w->done < w->requests && w->live > 0) {
+    int n = epoll_wait(w->epfd, events, MAX_EVENTS, REPLY_TIMEOUT_US / 1000);
+    int k;
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (n == 0) {
+      // Nothing moved for a whole reply timeout: give up on connections
+      // that are still waiting, as the blocking engine would.
+      for (j = 0; j < cfg->conns_per_thread; j++) {
+        if (w->aconns[j].count) {
+          aconn_fail(w, &w->aconns[j]);
+        }
+      }
+      continue;
+    }
+    for (k = 0; k < n; k++) {
+      if (events[k].data.ptr == NULL) {
+        uint64_t expirations;
+        while (read(w->tfd, &expirations, sizeof(expirations)) > 0) {
+        }
+        continue;
+      }
+      aconn_event(w, (aconn *)events[k].data.ptr, events[k].events);
+    }
+    if (cfg->open_loop) {
+      async_dispatch(w);
+    }
+  }
+
+  // Anything never issued because every connection died is a failure too.
+  w->failures += (uint64_t)(w->requests - w->issued);
+  for (j = 0; j < cfg->conns_per_thread; j++) {
+    aconn *a = &w->aconns[j];
+    if (a->fd >= 0) {
+      close(a->fd);
+    }
+    free(a->inflight);
+    free(a->wbuf);
+  }
+  close(w->tfd);
+  close(w->epfd);
+}
+
+static void *run_worker(void *arg) {
+  worker *w = (worker *)arg;
+  const client_config *cfg = w->cfg;
+  long j;
+
+  // Open connections before the clock starts so handshakes aren't measured
+  // (churn mode measures them on purpose).
+  if (cfg->engine == ENGINE_EPOLL) {
+    if (async_prepare(w) < 0) {
+      fprintf(stderr, "failed to set up epoll engine\n");
+      exit(1);
+    }
+  } else if (cfg->mode == CONN_PERSISTENT) {
+    for (j = 0; j < cfg->conns_per_thread; j++) {
+      w->conns[j].fd = connect_to(cfg->host, cfg->port);
+    }
+  }
+
+  if (cfg->pregen && worker_pregen(w) < 0) {
+    fprintf(stderr, "failed to allocate the pre-generated requests\n");
+    exit(1);
+  }
+
+  if (cfg->perf) {
+    memset(&w->perf, 0, sizeof(w->perf));
+    perf_open(&w->ps);
+  }
+
+  pthread_barrier_wait(cfg->barrier); // connected
+  pthread_barrier_wait(cfg->barrier); // cfg->start_ns is set
+
+  if (cfg->perf) {
+    perf_enable(&w->ps);
+  }
+
+  if (cfg->replay) {
+    schedule_next(w);
+  } else {
+    // Stagger fixed-rate schedules so threads don't fire in lockstep.
+    w->next_ns = cfg->start_ns + (uint64_t)(w->gap_ns * (double)w->id /
+                                            (double)cfg->threads);
+  }
+
+  if (cfg->engine == ENGINE_EPOLL) {
+    run_async(w);
+  } else {
+    run_sync(w);
+  }
+
+  if (cfg->perf) {
+    perf_disable(&w->ps);
+    perf_read(&w->ps, &w->perf);
+    perf_close(&w->ps);
+  }
+  return NULL;
+}
+
+// Warm-up: populates the keyspace before the measured run. Each thread takes
+// a contiguous range of keys over one persistent connection, packs sets into
+// batches of up to WARMUP_BATCH frames and keeps up to two batches in flight.
+#define WARMUP_BATCH 64
+#define WARMUP_BUF_SIZE 65536
+
+typedef struct {
+  const client_config *cfg;
+  pthread_t tid;
+  long first; // keys [first, last)
+  long last;
+  unsigned rng; // value sizes
+  uint64_t failures;
+  int started;
+} warmer;
+
+// Reads replies until at most keep requests are outstanding. A broken
+// connection fails everything in flight; the next send reconnects.
+static void warm_collect(warmer *wu, conn *c, unsigned *inflight,
+                         unsigned keep) {
+  while (*inflight > keep) {
+    if (recv_reply(c, NULL, 0) < 0) {
+      wu->failures += *inflight;
+      *inflight = 0;
+      conn_close(c);
+      return;
+    }
+    (*inflight)--;
+  }
+}
+
+// Sends count framed requests (hdr, then body if any) in one write.
+static void warm_send(warmer *wu, conn *c, const char *hdr, size_t hdr_len,
+                      const char *body, size_t body_len, unsigned count,
+                      unsigned *inflight) {
+  if (c->fd < 0) {
+    c->fd = connect_to(c->host, c->port);
+  }
+  if (c->fd < 0 || send_frame(c->fd, hdr, hdr_len, body, body_len) < 0) {
+    wu->failures += count + *inflight;
+    *inflight = 0;
+    conn_close(c);
+    return;
+  }
+  *inflight += count;
+  warm_collect(wu, c, inflight, WARMUP_BATCH);
+}
+
+static void *run_warmer(void *arg) {
+  warmer *wu = (warmer *)arg;
+  const client_config *cfg = wu->cfg;
+  char *buf = (char *)malloc(WARMUP_BUF_SIZE);
+  char *val = (char *)malloc(cfg->body_cap);
+  char *body = (char *)malloc(cfg->body_cap);
+  size_t blen = 0;
+  unsigned batched = 0;
+  unsigned inflight = 0;
+  conn c;
+  long i;
+
+  if (!buf || !val || !body ||
+      conn_init(&c, cfg->host, cfg->port, CONN_PERSISTENT, 1) < 0) {
+    wu->failures = (uint64_t)(wu->last - wu->first);
+    free(buf);
+    free(val);
+    free(body);
+    return NULL;
+  }
+
+  for (i = wu->first; i < wu->last; i++) {
+    char hdr[32];
+    size_t size = value_dist_next(&cfg->values, &wu->rng);
+    size_t body_len;
+    size_t n;
+
+    make_value(val, (uint32_t)i, size);
+    if (cfg->verify) {
+      cfg->shadow[i].state = SHADOW_PRESENT;
+      cfg->shadow[i].seed = (uint32_t)i;
+      cfg->shadow[i].size = (uint32_t)size;
+    }
+    body_len = (size_t)snprintf(body, cfg->body_cap, "set:k%ld:%s", i, val);
+    n = (size_t)snprintf(hdr, sizeof(hdr), "%zu:", body_len);
+
+    if (batched == WARMUP_BATCH || blen + n + body_len > WARMUP_BUF_SIZE) {
+      warm_send(wu, &c, buf, blen, NULL, 0, batched, &inflight);
+      blen = 0;
+      batched = 0;
+    }
+    if (n + body_len > WARMUP_BUF_SIZE) {
+      // Large values go out on their own rather than through the buffer.
+      warm_send(wu, &c, hdr, n, body, body_len, 1, &inflight);
+      continue;
+    }
+    memcpy(buf + blen, hdr, n);
+    memcpy(buf + blen + n, body, body_len);
+    blen += n + body_len;
+    batched++;
+  }
+  if (batched) {
+    warm_send(wu, &c, buf, blen, NULL, 0, batched, &inflight);
+  }
+  warm_collect(wu, &c, &inflight, 0);
+  if (cfg->verify && wu->failures) {
+    // Failed sets aren't tracked one by one; trust none of the range.
+    for (i = wu->first; i < wu->last; i++) {
+      cfg->shadow[i].state = SHADOW_UNKNOWN;
+    }
+  }
+
+  conn_free(&c);
+  free(buf);
+  free(val);
+  free(body);
+  return NULL;
+}
+
+// Runs the warm-up on cfg->warmup_threads threads. Returns the number of
+// failed sets.
+static uint64_t warm_up(const client_config *cfg) {
+  long n = cfg->warmup_threads < cfg->keyspace ? cfg->warmup_threads
+                                                : cfg->keyspace;
+  warmer *wu = (warmer *)calloc((size_t)n, sizeof(*wu));
+  uint64_t failures = 0;
+  long i;
+
+  if (!wu) {
+    return (uint64_t)cfg->keyspace;
+  }
+  for (i = 0; i < n; i++) {
+    wu[i].cfg = cfg;
+    wu[i].first = cfg->keyspace * i / n;
+    wu[i].last = cfg->keyspace * (i + 1) / n;
+    // Thread 0 draws the sizes the single-threaded warm-up always drew.
+    wu[i].rng = 0x2545f491U + (unsigned)i * 0x9e3779b9U;
+    wu[i].started =
+        pthread_create(&wu[i].tid, NULL, run_warmer, &wu[i]) == 0;
+    if (!wu[i].started) {
+      run_warmer(&wu[i]);
+    }
+  }
+  for (i = 0; i < n; i++) {
+    if (wu[i].started) {
+      pthread_join(wu[i].tid, NULL);
+    }
+    failures += wu[i].failures;
+  }
+  free(wu);
+  return failures;
+}
+
+// Interval reporting (--interval). A separate thread wakes every interval,
+// takes each worker's metrics for the interval and prints one snapshot.
+typedef struct {
+  worker *workers;
+  const client_config *cfg;
+  output_format format;
+  FILE *out;
+  pthread_t tid;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int stop; // set once the workers are done; flushes a last partial interval
+} reporter;
+
+static void print_interval(const reporter *r, unsigned n, uint64_t from_ns,
+                           uint64_t to_ns, const metric *iv) {
+  double from = (double)(from_ns - r->cfg->start_ns) / 1e9;
+  double to = (double)(to_ns - r->cfg->start_ns) / 1e9;
+  double rate;
+  uint64_t ops = 0;
+  unsigned op;
+
+  for (op = 0; op < OP_COUNT; op++) {
+    ops += iv[op].count;
+  }
+  rate = to > from ? (double)ops / (to - from) : 0.0;
+
+  if (r->format == FORMAT_JSON) {
+    fprintf(r->out, "{\"interval\":%u,\"start_s\":%.3f,\"end_s\":%.3f,"
+                    "\"throughput\":%.1f,",
+            n, from, to, rate);
+    json_metrics(r->out, iv);
+    fprintf(r->out, "}\n");
+  } else if (r->format == FORMAT_CSV) {
+    for (op = 0; op < OP_COUNT; op++) {
+      fprintf(r->out, "%u,%.3f,%.3f,%.1f,", n, from, to, rate);
+      csv_metric(r->out, op, &iv[op]);
+      fprintf(r->out, "\n");
+    }
+  } else {
+    fprintf(r->out, "[%7.3f s] %9.0f ops/s", to, rate);
+    for (op = 0; op < OP_COUNT; op++) {
+      if (iv[op].count) {
+        fprintf(r->out, "  %s p50 %.1f p99 %.1f max %.1f", op_names[op],
+                (double)metric_percentile(&iv[op], 0.50) / 1e3,
+                (double)metric_percentile(&iv[op], 0.99) / 1e3,
+                (double)iv[op].max_ns / 1e3);
+      }
+    }
+    fprintf(r->out, " us\n");
+  }
+  fflush(r->out);
+}
+
+static void *run_reporter(void *arg) {
+  reporter *r = (reporter *)arg;
+  const client_config *cfg = r->cfg;
+  metric *iv = (metric *)malloc(OP_COUNT * sizeof(*iv));
+  uint64_t from_ns = cfg->start_ns;
+  unsigned n = 0;
+  int stop = 0;
+  long i;
+  unsigned op;
+
+  if (!iv) {
+    fprintf(stderr, "failed to allocate interval metrics\n");
+    return NULL;
+  }
+  if (r->format == FORMAT_CSV) {
+    fprintf(r->out, "interval,start_s,end_s,throughput,");
+    csv_metric_header(r->out);
+    fprintf(r->out, "\n");
+  }
+
+  while (!stop) {
+    uint64_t to_ns = from_ns + cfg->interval_ns;
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(to_ns / 1000000000ULL);
+    ts.tv_nsec = (long)(to_ns % 1000000000ULL);
+    pthread_mutex_lock(&r->lock);
+    while (!r->stop &&
+           pthread_cond_timedwait(&r->cond, &r->lock, &ts) != ETIMEDOUT) {
+    }
+    stop = r->stop;
+    pthread_mutex_unlock(&r->lock);
+    if (stop) {
+      to_ns = now_ns();
+    }
+
+    memset(iv, 0, OP_COUNT * sizeof(*iv));
+    for (i = 0; i < cfg->threads; i++) {
+      worker *w = &r->workers[i];
+      pthread_mutex_lock(&w->iv_lock);
+      for (op = 0; op < OP_COUNT; op++) {
+        metric_merge(&iv[op], &w->iv[op]);
+        if (w->iv[op].count) {
+          memset(&w->iv[op], 0, sizeof(w->iv[op]));
+        }
+      }
+      pthread_mutex_unlock(&w->iv_lock);
+    }
+    // A sliver left over at the end would only report a noisy rate.
+    if (!stop || (to_ns - from_ns) * 10 >= cfg->interval_ns) {
+      print_interval(r, n++, from_ns, to_ns, iv);
+    }
+    from_ns = to_ns;
+  }
+  free(iv);
+  return NULL;
+}
+
+static void print_config(const client_config *cfg, const char *replay_path) {
+  printf("Target: %s:%d\n", cfg->host, cfg->port);
+  if (cfg->duration_ns) {
+    printf("Duration: %.3f s measured, %.3f s warm-up, %.3f s cool-down\n",
+           (double)cfg->duration_ns / 1e9, (double)cfg->warmup_ns / 1e9,
+           (double)cfg->cooldown_ns / 1e9);
+  }
+  if (cfg->requests) {
+    printf("Requests: %ld%s, Keyspace: %ld\n", cfg->requests,
+           cfg->pregen ? " (pre-generated)" : "", cfg->keyspace);
+  } else {
+    printf("Requests: unlimited, Keyspace: %ld\n", cfg->keyspace);
+  }
+  if (cfg->mode == CONN_CHURN) {
+    printf("Threads: %ld, Connections: churn (one per request)\n",
+           cfg->threads);
+  } else {
+    printf("Threads: %ld, Connections: %ld per thread (%ld total), "
+           "%s engine\n",
+           cfg->threads, cfg->conns_per_thread,
+           cfg->threads * cfg->conns_per_thread,
+           cfg->engine == ENGINE_EPOLL ? "epoll" : "sync");
+  }
+  if (cfg->pipeline > 1) {
+    printf("Pipeline: %u requests in flight per connection\n",
+           cfg->pipeline);
+  }
+  print_mix(&cfg->mix);
+  if (cfg->keys.kind == KEYS_HOTSPOT) {
+    printf("Keys: hotspot (%.0f%% of ops on %.0f%% of keys)\n",
+           cfg->keys.hot_ops * 100.0, cfg->keys.hot_frac * 100.0);
+  } else if (cfg->keys.kind != KEYS_UNIFORM) {
+    printf("Keys: %s (theta %.2f)\n", key_dist_name(&cfg->keys),
+           cfg->keys.theta);
+  } else {
+    printf("Keys: uniform\n");
+  }
+  value_dist_print(&cfg->values);
+  if (cfg->replay) {
+    printf("Load: replay of %s, %ld records, ", replay_path, cfg->requests);
+    if (cfg->speed > 0) {
+      printf("%.2fx original speed\n", cfg->speed);
+    } else {
+      printf("as fast as possible\n");
+    }
+  } else if (cfg->rate > 0) {
+    printf("Load: open loop, %.0f ops/s target (%s arrivals)\n", cfg->rate,
+           cfg->arrival == ARRIVAL_POISSON ? "poisson" : "fixed");
+  } else {
+    printf("Load: closed loop\n");
+  }
+  if (cfg->co_correct) {
+    printf("Correction: coordinated omission, one request every %.1f us\n",
+           (double)cfg->co_interval_ns / 1e3);
+  }
+}
+
+// Outcome of a run, as reported in every output format.
+typedef struct {
+  double seconds; // measured time: the whole run, or the duration window
+  double run_seconds; // wall time of the run, warm-up to cool-down
+  double throughput;
+  long issued;
+  uint64_t failures;
+  uint64_t late;
+  double warmup_seconds;
+  uint64_t warmup_failures;
+  uint64_t verified; // --verify counters, summed over workers
+  uint64_t mismatches;
+  uint64_t stale;
+  uint64_t misses;
+  perf_counts perf; // --perf: summed over workers
+} run_result;
+
+static const char *load_name(const client_config *cfg) {
+  if (cfg->replay) {
+    return "replay";
+  }
+  return cfg->rate > 0 ? "open" : "closed";
+}
+
+// Everything up to the results: schema, host, config and workload.
+static void json_head(const client_config *cfg, const char *replay_path) {
+  host_info h;
+  host_info_get(&h);
+  printf("{\"schema\":%d,\"benchmark\":\"client\",", RESULT_SCHEMA);
+  json_host(&h);
+  printf(",\"config\":{\"host\":");
+  json_string(cfg->host);
+  printf(",\"port\":%d,\"requests\":%ld,\"keyspace\":%ld,\"threads\":%ld",
+         cfg->port, cfg->requests, cfg->keyspace, cfg->threads);
+  printf(",\"connections_per_thread\":%ld,\"churn\":%s,\"engine\":\"%s\"",
+         cfg->conns_per_thread, cfg->mode == CONN_CHURN ? "true" : "false",
+         cfg->engine == ENGINE_EPOLL ? "epoll" : "sync");
+  printf(",\"pipeline\":%u,\"load\":\"%s\",\"rate\":%g,\"arrival\":\"%s\"",
+         cfg->pipeline, load_name(cfg), cfg->rate,
+         cfg->arrival == ARRIVAL_POISSON ? "poisson" : "fixed");
+  printf(",\"replay\":");
+  if (replay_path) {
+    json_string(replay_path);
+  } else {
+    printf("null");
+  }
+  printf(",\"speed\":%g,\"warmup_threads\":%ld,\"verify\":%s",
+         cfg->speed, cfg->warmup_threads, cfg->verify ? "true" : "false");
+  printf(",\"pregen\":%s,\"perf\":%s", cfg->pregen ? "true" : "false",
+         cfg->perf ? "true" : "false");
+  printf(",\"duration_s\":%g,\"warmup_s\":%g,\"cooldown_s\":%g",
+         (double)cfg->duration_ns / 1e9, (double)cfg->warmup_ns / 1e9,
+         (double)cfg->cooldown_ns / 1e9);
+  printf(",\"co_correct\":%s,\"co_interval_us\":%g},",
+         cfg->co_correct ? "true" : "false",
+         (double)cfg->co_interval_ns / 1e3);
+  json_workload(&cfg->mix, &cfg->keys, &cfg->values);
+}
+
+// co holds the corrected metrics of a --co-correct run, NULL otherwise.
+static void print_json(const client_config *cfg, const char *replay_path,
+                       const metric *m, const metric *co,
+                       const run_result *res) {
+  json_head(cfg, replay_path);
+  printf(",\"results\":{\"seconds\":%.6f,\"throughput\":%.1f",
+         res->seconds, res->throughput);
+  printf(",\"failures\":%llu,\"late\":%llu,",
+         (unsigned long long)res->failures, (unsigned long long)res->late);
+  printf("\"warmup\":{\"keys\":%ld,\"seconds\":%.6f,\"failures\":%llu},",
+         cfg->keyspace, res->warmup_seconds,
+         (unsigned long long)res->warmup_failures);
+  printf("\"verify\":{\"checked\":%llu,\"mismatches\":%llu,\"stale\":%llu,"
+         "\"misses\":%llu},",
+         (unsigned long long)res->verified,
+         (unsigned long long)res->mismatches, (unsigned long long)res->stale,
+         (unsigned long long)res->misses);
+  json_metrics(stdout, m);
+  printf(",\"corrected\":");
+  if (co) {
+    printf("{");
+    json_metrics(stdout, co);
+    printf("}");
+  } else {
+    printf("null");
+  }
+  printf(",");
+  if (cfg->perf) {
+    json_perf(&res->perf, (double)res->issued);
+  } else {
+    printf("\"perf\":null");
+  }
+  printf("}}\n");
+}
+
+// One row per operation, then one per operation for the corrected metrics
+// of a --co-correct run; run-wide columns repeat so rows stand alone.
+static void print_csv(const client_config *cfg, const char *replay_path,
+                      const metric *m, const metric *co,
+                      const run_result *res) {
+  host_info h;
+  unsigned op;
+  host_info_get(&h);
+  printf("schema,benchmark,");
+  csv_host_header();
+  printf(",host,port,requests,keyspace,threads,connections_per_thread,churn,"
+         "engine,pipeline,load,rate,arrival,replay,speed,warmup_threads,"
+         "verify,");
+  csv_workload_header();
+  printf(",seconds,throughput,failures,late,corrected,");
+  csv_metric_header(stdout);
+  printf(",warmup_seconds,warmup_failures,verify_checked,verify_mismatches,"
+         "verify_stale,verify_misses,duration_s,warmup_s,cooldown_s,"
+         "co_interval_us,pregen,");
+  csv_perf_header();
+  printf("\n");
+  for (op = 0; op < (co ? 2 * OP_COUNT : OP_COUNT); op++) {
+    printf("%d,client,", RESULT_SCHEMA);
+    csv_host(&h);
+    putchar(',');
+    csv_string(cfg->host);
+    printf(",%d,%ld,%ld,%ld,%ld,%d,%s,%u,%s,%g,%s,", cfg->port, cfg->requests,
+           cfg->keyspace, cfg->threads, cfg->conns_per_thread,
+           cfg->mode == CONN_CHURN,
+           cfg->engine == ENGINE_EPOLL ? "epoll" : "sync", cfg->pipeline,
+           load_name(cfg), cfg->rate,
+           cfg->arrival == ARRIVAL_POISSON ? "poisson" : "fixed");
+    csv_string(replay_path ? replay_path : "");
+    printf(",%g,%ld,%d,", cfg->speed, cfg->warmup_threads, cfg->verify);
+    csv_workload(&cfg->mix, &cfg->keys, &cfg->values);
+    printf(",%.6f,%.1f,%llu,%llu,%d,", res->seconds, res->throughput,
+           (unsigned long long)res->failures, (unsigned long long)res->late,
+           op >= OP_COUNT);
+    if (op < OP_COUNT) {
+      csv_metric(stdout, op, &m[op]);
+    } else {
+      csv_metric(stdout, op - OP_COUNT, &co[op - OP_COUNT]);
+    }
+    printf(",%.6f,%llu,%llu,%llu,%llu,%llu", res->warmup_seconds,
+           (unsigned long long)res->warmup_failures,
+           (unsigned long long)res->verified,
+           (unsigned long long)res->mismatches, (unsigned long long)res->stale,
+           (unsigned long long)res->misses);
+    printf(",%g,%g,%g,%g,%d,", (double)cfg->duration_ns / 1e9,
+           (double)cfg->warmup_ns / 1e9, (double)cfg->cooldown_ns / 1e9,
+           (double)cfg->co_interval_ns / 1e3, cfg->pregen);
+    csv_perf(&res->perf, (double)res->issued);
+    printf("\n");
+  }
+}
+
+// Runs the workers once, from connecting to the end of the run, and merges
+// their metrics into m (and corrected ones into co, if set) and their
+// counters into res. rep, if set, reports intervals for the duration of the
+// phase.
+static int run_phase(client_config *cfg, worker *workers, reporter *rep,
+                     metric *m, metric *co, run_result *res) {
+  pthread_barrier_t barrier;
+  uint64_t start_ns, end_ns;
+  long i, j;
+
+  pthread_barrier_init(&barrier, NULL, (unsigned)cfg->threads + 1);
+  cfg->barrier = &barrier;
+  for (i = 0; i < cfg->threads; i++) {
+    if (pthread_create(&workers[i].tid, NULL, run_worker, &workers[i]) != 0) {
+      fprintf(stderr, "failed to start worker thread\n");
+      return -1;
+    }
+  }
+  pthread_barrier_wait(&barrier);
+  start_ns = now_ns();
+  cfg->start_ns = start_ns;
+  if (cfg->duration_ns) {
+    cfg->window_ns = start_ns + cfg->warmup_ns;
+    cfg->end_ns = cfg->window_ns + cfg->duration_ns + cfg->cooldown_ns;
+  }
+  if (rep) {
+    rep->workers = workers;
+    rep->stop = 0;
+    if (pthread_create(&rep->tid, NULL, run_reporter, rep) != 0) {
+      fprintf(stderr, "failed to start interval reporter\n");
+      return -1;
+    }
+  }
+  pthread_barrier_wait(&barrier);
+
+  for (i = 0; i < cfg->threads; i++) {
+    pthread_join(workers[i].tid, NULL);
+  }
+
+  end_ns = now_ns();
+  pthread_barrier_destroy(&barrier);
+
+  if (rep) {
+    pthread_mutex_lock(&rep->lock);
+    rep->stop = 1;
+    pthread_cond_signal(&rep->cond);
+    pthread_mutex_unlock(&rep->lock);
+    pthread_join(rep->tid, NULL);
+  }
+
+  for (i = 0; i < cfg->threads; i++) {
+    for (j = 0; j < OP_COUNT; j++) {
+      metric_merge(&m[j], &workers[i].m[j]);
+      if (co) {
+        metric_merge(&co[j], &workers[i].co[j]);
+      }
+    }
+    res->failures += workers[i].failures;
+    res->late += workers[i].late;
+    res->verified += workers[i].verified;
+    res->mismatches += workers[i].mismatches;
+    res->stale += workers[i].stale;
+    res->misses += workers[i].misses;
+    res->issued += workers[i].issued;
+    perf_merge(&res->perf, &workers[i].perf);
+  }
+
+  res->run_seconds = (double)(end_ns - start_ns) / 1e9;
+  res->seconds = res->run_seconds;
+  res->throughput = (double)cfg->requests / res->run_seconds;
+  if (cfg->duration_ns) {
+    uint64_t measured = 0;
+    uint64_t to = cfg->window_ns + cfg->duration_ns;
+    for (j = 0; j < OP_COUNT; j++) {
+      measured += m[j].count;
+    }
+    // A request cap can end the run before the window does.
+    if (end_ns < to) {
+      to = end_ns;
+    }
+    res->seconds = to > cfg->window_ns
+                       ? (double)(to - cfg->window_ns) / 1e9
+                       : 0.0;
+    res->throughput = res->seconds > 0 ? (double)measured / res->seconds : 0.0;
+  }
+  return 0;
+}
+
+static void print_results(const client_config *cfg, const char *replay_path,
+                          const metric *m, const metric *co,
+                          const run_result *res, output_format format) {
+  unsigned j;
+
+  if (format == FORMAT_JSON) {
+    print_json(cfg, replay_path, m, co, res);
+  } else if (format == FORMAT_CSV) {
+    print_csv(cfg, replay_path, m, co, res);
+  } else {
+    printf("\nResults\n");
+    if (cfg->duration_ns) {
+      printf("  Total time: %.3f s (%.3f s measured)\n", res->run_seconds,
+             res->seconds);
+    } else {
+      printf("  Total time: %.3f s\n", res->seconds);
+    }
+    printf("  Throughput: %.0f ops/s\n", res->throughput);
+    printf("  Failures: %llu\n", (unsigned long long)res->failures);
+    if (cfg->open_loop) {
+      printf("  Late sends: %llu (%.1f%%)\n", (unsigned long long)res->late,
+             100.0 * (double)res->late / (double)res->issued);
+    }
+    if (cfg->verify) {
+      printf("  Verified: %llu reads, %llu mismatches, %llu stale, "
+             "%llu unexpected misses\n",
+             (unsigned long long)res->verified,
+             (unsigned long long)res->mismatches,
+             (unsigned long long)res->stale, (unsigned long long)res->misses);
+    }
+    if (cfg->perf) {
+      print_perf(&res->perf, (double)res->issued);
+    }
+
+    for (j = 0; j < OP_COUNT; j++) {
+      print_metric(op_names[j], &m[j]);
+    }
+    if (co) {
+      printf("\n  Corrected for coordinated omission\n");
+      for (j = 0; j < OP_COUNT; j++) {
+        print_metric(op_names[j], &co[j]);
+      }
+    }
+  }
+}
+
+// Saturation sweep (--sweep): runs one duration phase per load step, from
+// low to high, and reports the knee, the highest step whose p99 over all
+// ops stays within the objective. The sweep stops at the first step that
+// misses it.
+typedef enum {
+  SWEEP_NONE,
+  SWEEP_RATE,     // open loop, target ops/s over all threads
+  SWEEP_PIPELINE, // closed loop, requests in flight per connection
+} sweep_mode;
+
+typedef struct {
+  sweep_mode mode;
+  double from;
+  double to;
+  double step;
+  double slo_p99_us;
+} sweep_spec;
+
+#define SWEEP_P99 2 // index of p99 in report_q
+#define SWEEP_STEP_SECONDS 5.0 // default hold time per step
+
+typedef struct {
+  double load;
+  double throughput;
+  uint64_t failures;
+  uint64_t late;
+  uint64_t count;
+  double avg_us;
+  double q_us[REPORT_Q_COUNT];
+  double max_us;
+  int ok;
+} sweep_step;
+
+// Parses "rate:FROM:TO:STEP" or "pipeline:FROM:TO:STEP".
+static int sweep_parse(sweep_spec *sw, const char *spec) {
+  char name[16];
+  if (sscanf(spec, "%15[a-z]:%lf:%lf:%lf", name, &sw->from, &sw->to,
+             &sw->step) != 4 ||
+      sw->from <= 0 || sw->to < sw->from || sw->step <= 0) {
+    return -1;
+  }
+  if (strcmp(name, "rate") == 0) {
+    sw->mode = SWEEP_RATE;
+  } else if (strcmp(name, "pipeline") == 0) {
+    sw->mode = SWEEP_PIPELINE;
+    if (sw->to > 65536) {
+      return -1;
+    }
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static const char *sweep_name(const sweep_spec *sw) {
+  return sw->mode == SWEEP_RATE ? "rate" : "pipeline";
+}
+
+// Requests and open-loop spacing for this worker's share of the run.
+static void worker_plan(worker *w) {
+  const client_config *cfg = w->cfg;
+  long i = w->id;
+  // Spread the remainder so the totals add up to the requested count.
+  w->requests =
+      cfg->requests / cfg->threads + (i < cfg->requests % cfg->threads);
+  if (cfg->requests == 0) {
+    w->requests = LONG_MAX; // until the duration is up
+  }
+  w->gap_ns = cfg->rate > 0 ? 1e9 * (double)cfg->threads / cfg->rate : 0.0;
+}
+
+// Clears a worker's results and connections so it can run another phase.
+static int worker_reset(worker *w) {
+  const client_config *cfg = w->cfg;
+  long j;
+
+  memset(w->m, 0, sizeof(w->m));
+  memset(w->co, 0, sizeof(w->co));
+  w->failures = 0;
+  w->late = 0;
+  w->verified = 0;
+  w->mismatches = 0;
+  w->stale = 0;
+  w->misses = 0;
+  w->issued = 0;
+  w->done = 0;
+  w->live = 0;
+  w->rr = 0;
+  w->carry = 0;
+  worker_plan(w);
+  if (w->aconns) {
+    memset(w->aconns, 0, (size_t)cfg->conns_per_thread * sizeof(*w->aconns));
+    return 0;
+  }
+  for (j = 0; j < cfg->conns_per_thread; j++) {
+    conn_free(&w->conns[j]);
+    if (conn_init(&w->conns[j], cfg->host, cfg->port, cfg->mode,
+                  cfg->pipeline) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void print_sweep(const client_config *cfg, const char *replay_path,
+                        const sweep_spec *sw, const sweep_step *steps,
+                        long n, long knee, output_format format) {
+  host_info h;
+  unsigned q;
+  long k;
+
+  if (format == FORMAT_TEXT) {
+    if (knee < 0) {
+      printf("\nKnee: none, the first step already missed p99 <= %.1f us\n",
+             sw->slo_p99_us);
+    } else {
+      printf("\nKnee: %s %.0f (%.0f ops/s, p99 %.1f us)\n", sweep_name(sw),
+             steps[knee].load, steps[knee].throughput,
+             steps[knee].q_us[SWEEP_P99]);
+    }
+    return;
+  }
+
+  if (format == FORMAT_JSON) {
+    json_head(cfg, replay_path);
+    printf(",\"sweep\":{\"mode\":\"%s\",\"slo_p99_us\":%g,\"step_s\":%g,"
+           "\"steps\":[",
+           sweep_name(sw), sw->slo_p99_us, (double)cfg->duration_ns / 1e9);
+    for (k = 0; k < n; k++) {
+      const sweep_step *st = &steps[k];
+      printf("%s{\"load\":%g,\"throughput\":%.1f,\"failures\":%llu,"
+             "\"late\":%llu,\"count\":%llu,\"avg_us\":%.3f",
+             k ? "," : "", st->load, st->throughput,
+             (unsigned long long)st->failures, (unsigned long long)st->late,
+             (unsigned long long)st->count, st->avg_us);
+      for (q = 0; q < REPORT_Q_COUNT; q++) {
+        printf(",\"%s_us\":%.3f", report_q_names[q], st->q_us[q]);
+      }
+      printf(",\"max_us\":%.3f,\"ok\":%s}", st->max_us,
+             st->ok ? "true" : "false");
+    }
+    printf("],\"knee\":");
+    if (knee < 0) {
+      printf("null");
+    } else {
+      printf("%g", steps[knee].load);
+    }
+    printf("}}\n");
+    return;
+  }
+
+  host_info_get(&h);
+  printf("schema,benchmark,");
+  csv_host_header();
+  printf(",mode,slo_p99_us,step_s,load,throughput,failures,late,count,"
+         "avg_us");
+  for (q = 0; q < REPORT_Q_COUNT; q++) {
+    printf(",%s_us", report_q_names[q]);
+  }
+  printf(",max_us,ok,knee\n");
+  for (k = 0; k < n; k++) {
+    const sweep_step *st = &steps[k];
+    printf("%d,client,", RESULT_SCHEMA);
+    csv_host(&h);
+    printf(",%s,%g,%g,%g,%.1f,%llu,%llu,%llu,%.3f", sweep_name(sw),
+           sw->slo_p99_us, (double)cfg->duration_ns / 1e9, st->load,
+           st->throughput, (unsigned long long)st->failures,
+           (unsigned long long)st->late, (unsigned long long)st->count,
+           st->avg_us);
+    for (q = 0; q < REPORT_Q_COUNT; q++) {
+      printf(",%.3f", st->q_us[q]);
+    }
+    printf(",%.3f,%d,%d\n", st->max_us, st->ok, k == knee);
+  }
+}
+
+static int run_sweep(client_config *cfg, worker *workers, reporter *rep,
+                     const sweep_spec *sw, output_format format,
+                     const char *replay_path) {
+  long n = (long)((sw->to - sw->from) / sw->step + 1e-9) + 1;
+  sweep_step *steps = (sweep_step *)calloc((size_t)n, sizeof(*steps));
+  metric *m = (metric *)malloc((2 * OP_COUNT + 1) * sizeof(*m));
+  metric *co, *all;
+  long knee = -1;
+  long done = 0;
+  long k, i;
+  unsigned op, q;
+
+  if (!steps || !m) {
+    fprintf(stderr, "failed to allocate sweep results\n");
+    free(steps);
+    free(m);
+    return -1;
+  }
+  // Corrected latencies, when kept, are the ones held to the objective.
+  co = &m[OP_COUNT];
+  all = &m[2 * OP_COUNT];
+
+  if (format == FORMAT_TEXT) {
+    printf("\nSweep: %s %g..%g step %g, %.3f s per step, "
+           "SLO p99 <= %.1f us%s\n",
+           sweep_name(sw), sw->from, sw->to, sw->step,
+           (double)cfg->duration_ns / 1e9, sw->slo_p99_us,
+           cfg->co_correct ? " (corrected)" : "");
+    printf("%12s %12s %9s %10s %10s %10s %10s\n", "load", "ops/s",
+           "failures", "p50 us", "p99 us", "p99.9 us", "max us");
+  }
+
+  for (k = 0; k < n; k++) {
+    sweep_step *st = &steps[k];
+    run_result res = {0};
+
+    st->load = sw->from + (double)k * sw->step;
+    if (sw->mode == SWEEP_RATE) {
+      cfg->rate = st->load;
+      cfg->open_loop = 1;
+    } else {
+      cfg->pipeline = (unsigned)st->load;
+    }
+    for (i = 0; i < cfg->threads; i++) {
+      if (worker_reset(&workers[i]) < 0) {
+        fprintf(stderr, "failed to allocate worker buffers\n");
+        free(steps);
+        free(m);
+        return -1;
+      }
+    }
+    memset(m, 0, (2 * OP_COUNT + 1) * sizeof(*m));
+    if (run_phase(cfg, workers, rep, m, co, &res) < 0) {
+      free(steps);
+      free(m);
+      return -1;
+    }
+    for (op = 0; op < OP_COUNT; op++) {
+      metric_merge(all, cfg->co_correct ? &co[op] : &m[op]);
+    }
+
+    st->throughput = res.throughput;
+    st->failures = res.failures;
+    st->late = res.late;
+    st->count = all->count;
+    st->avg_us = metric_avg_us(all);
+    for (q = 0; q < REPORT_Q_COUNT; q++) {
+      st->q_us[q] = (double)metric_percentile(all, report_q[q]) / 1e3;
+    }
+    st->max_us = (double)all->max_ns / 1e3;
+    st->ok = all->count > 0 && res.failures == 0 &&
+             st->q_us[SWEEP_P99] <= sw->slo_p99_us;
+    done++;
+
+    if (format == FORMAT_TEXT) {
+      printf("%12g %12.0f %9llu %10.1f %10.1f %10.1f %10.1f%s\n", st->load,
+             st->throughput, (unsigned long long)st->failures, st->q_us[0],
+             st->q_us[SWEEP_P99], st->q_us[SWEEP_P99 + 1], st->max_us,
+             st->ok ? "" : "  over SLO");
+      fflush(stdout);
+    }
+    if (!st->ok) {
+      break;
+    }
+    knee = k;
+  }
+
+  print_sweep(cfg, replay_path, sw, steps, done, knee, format);
+  free(steps);
+  free(m);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  client_config cfg = {
+      .threads = 1,
+      .conns_per_thread = 1,
+      .mode = CONN_PERSISTENT,
+      .arrival = ARRIVAL_FIXED,
+      .pipeline = 1,
+      .engine = ENGINE_SYNC,
+      .speed = 1.0,
+  };
+  trace replay;
+  const char *replay_path = NULL;
+  output_format format = FORMAT_TEXT;
+  double interval = 0;
+  double duration = 0, warmup_s = 0, cooldown_s = 0;
+  double co_interval = 0;
+  sweep_spec sweep = {.mode = SWEEP_NONE, .slo_p99_us = 1000.0};
+  const char *interval_path = NULL;
+  reporter rep;
+  long i, j;
+  worker *workers;
+  static metric m[OP_COUNT];
+  static metric co[OP_COUNT];
+  int keys_given = 0;
+  uint64_t start_ns;
+  run_result res = {0};
+  int opt;
+
+  static const struct option long_opts[] = {
+      {"threads", required_argument, NULL, 't'},
+      {"connections", required_argument, NULL, 'c'},
+      {"churn", no_argument, NULL, 'C'},
+      {"rate", required_argument, NULL, 'r'},
+      {"arrival", required_argument, NULL, 'a'},
+      {"keys", required_argument, NULL, 'k'},
+      {"mix", required_argument, NULL, 'm'},
+      {"values", required_argument, NULL, 'v'},
+      {"pipeline", required_argument, NULL, 'p'},
+      {"engine", required_argument, NULL, 'e'},
+      {"replay", required_argument, NULL, 'R'},
+      {"speed", required_argument, NULL, 'S'},
+      {"format", required_argument, NULL, 'f'},
+      {"interval", required_argument, NULL, 'i'},
+      {"interval-out", required_argument, NULL, 'I'},
+      {"warmup-threads", required_argument, NULL, 'W'},
+      {"verify", no_argument, NULL, 'V'},
+      {"duration", required_argument, NULL, 'd'},
+      {"warmup-seconds", required_argument, NULL, 'w'},
+      {"cooldown-seconds", required_argument, NULL, 'x'},
+      {"sweep", required_argument, NULL, 's'},
+      {"slo-p99", required_argument, NULL, 'L'},
+      {"co-correct", required_argument, NULL, 'O'},
+      {"pregen", no_argument, NULL, 'P'},
+      {"perf", no_argument, NULL, 'H'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  key_dist_parse(&cfg.keys, "uniform");
+  op_mix_parse(&cfg.mix, "default");
+  value_dist_parse(&cfg.values, "default");
+
+  while ((opt = getopt_long(argc, argv, "t:c:r:k:m:v:p:e:f:i:d:h", long_opts,
+                            NULL)) != -1) {
+    switch (opt) {
+    case 't':
+      cfg.threads = atol(optarg);
+      break;
+    case 'c':
+      cfg.conns_per_thread = atol(optarg);
+      break;
+    case 'C':
+      cfg.mode = CONN_CHURN;
+      break;
+    case 'r':
+      cfg.rate = atof(optarg);
+      break;
+    case 'k':
+      if (key_dist_parse(&cfg.keys, optarg) < 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      keys_given = 1;
+      break;
+    case 'm':
+      if (op_mix_parse(&cfg.mix, optarg) < 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'p':
+      cfg.pipeline = (unsigned)atoi(optarg);
+      break;
+    case 'R':
+      replay_path = optarg;
+      break;
+    case 'S':
+      cfg.speed = atof(optarg);
+      break;
+    case 'f':
+      if (format_parse(&format, optarg) < 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'i':
+      interval = atof(optarg);
+      break;
+    case 'I':
+      interval_path = optarg;
+      break;
+    case 'W':
+      cfg.warmup_threads = atol(optarg);
+      break;
+    case 'V':
+      cfg.verify = 1;
+      break;
+    case 'd':
+      duration = atof(optarg);
+      break;
+    case 'w':
+      warmup_s = atof(optarg);
+      break;
+    case 'x':
+      cooldown_s = atof(optarg);
+      break;
+    case 's':
+      if (sweep_parse(&sweep, optarg) < 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'L':
+      sweep.slo_p99_us = atof(optarg);
+      break;
+    case 'P':
+      cfg.pregen = 1;
+      break;
+    case 'H':
+      cfg.perf = 1;
+      break;
+    case 'O':
+      cfg.co_correct = 1;
+      co_interval = atof(optarg);
+      break;
+    case 'e':
+      if (strcmp(optarg, "sync") == 0) {
+        cfg.engine = ENGINE_SYNC;
+      } else if (strcmp(optarg, "epoll") == 0) {
+        cfg.engine = ENGINE_EPOLL;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'v':
+      value_dist_free(&cfg.values);
+      if (value_dist_parse(&cfg.values, optarg) < 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'a':
+      if (strcmp(optarg, "fixed") == 0) {
+        cfg.arrival = ARRIVAL_FIXED;
+      } else if (strcmp(optarg, "poisson") == 0) {
+        cfg.arrival = ARRIVAL_POISSON;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (argc - optind != 4) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  cfg.host = argv[optind];
+  cfg.port = atoi(argv[optind + 1]);
+  cfg.requests = atol(argv[optind + 2]);
+  cfg.keyspace = atol(argv[optind + 3]);
+
+  // Each sweep step is a duration run.
+  if (sweep.mode != SWEEP_NONE && duration == 0) {
+    duration = SWEEP_STEP_SECONDS;
+  }
+
+  // Duration runs take <requests> as a cap; 0 leaves them unbounded.
+  if (cfg.port <= 0 || cfg.requests < 0 ||
+      (cfg.requests == 0 && duration <= 0) || cfg.keyspace <= 0 ||
+      duration < 0 || warmup_s < 0 || cooldown_s < 0 ||
+      (duration == 0 && (warmup_s > 0 || cooldown_s > 0)) ||
+      (sweep.mode != SWEEP_NONE && (replay_path || sweep.slo_p99_us <= 0)) ||
+      (sweep.mode == SWEEP_PIPELINE && cfg.mode == CONN_CHURN) ||
+      (cfg.co_correct && co_interval <= 0) ||
+      (cfg.pregen && (cfg.engine == ENGINE_EPOLL || cfg.requests == 0 ||
+                      replay_path || sweep.mode != SWEEP_NONE)) ||
+      (cfg.perf && sweep.mode != SWEEP_NONE) ||
+      // Open-loop latency already runs from the intended send time.
+      (cfg.co_correct && (cfg.rate > 0 || (replay_path && cfg.speed > 0) ||
+                          sweep.mode == SWEEP_RATE)) ||
+      cfg.threads <= 0 || cfg.conns_per_thread <= 0 || cfg.rate < 0 ||
+      cfg.speed < 0 || (replay_path && cfg.rate > 0) || interval < 0 ||
+      (interval_path && interval == 0) ||
+      cfg.warmup_threads < 0 ||
+      (cfg.verify && (replay_path || cfg.engine == ENGINE_EPOLL ||
+                      cfg.keyspace < cfg.threads * cfg.conns_per_thread)) ||
+      cfg.pipeline == 0 || cfg.pipeline > 65536 ||
+      (cfg.mode == CONN_CHURN &&
+       (cfg.pipeline > 1 || cfg.engine == ENGINE_EPOLL))) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Presets bring their own request distribution unless -k overrides it.
+  if (!keys_given && cfg.mix.keys != KEYS_UNIFORM) {
+    key_dist_parse(&cfg.keys,
+                   cfg.mix.keys == KEYS_LATEST ? "latest" : "zipfian");
+  }
+  key_dist_init(&cfg.keys, (uint32_t)cfg.keyspace);
+  cfg.body_cap = cfg.values.max + KEY_MAX + 16;
+
+  if (replay_path) {
+    if (trace_load(&replay, replay_path) < 0) {
+      fprintf(stderr, "failed to load trace %s\n", replay_path);
+      return 1;
+    }
+    if (cfg.requests == 0 || (size_t)cfg.requests > replay.n) {
+      cfg.requests = (long)replay.n;
+    }
+    if (replay.max_value + 256 + 16 > cfg.body_cap) {
+      cfg.body_cap = replay.max_value + 256 + 16;
+    }
+    cfg.replay = &replay;
+  }
+  cfg.open_loop = cfg.rate > 0 || (cfg.replay && cfg.speed > 0);
+  cfg.interval_ns = (uint64_t)(interval * 1e9);
+  cfg.duration_ns = (uint64_t)(duration * 1e9);
+  cfg.warmup_ns = (uint64_t)(warmup_s * 1e9);
+  cfg.cooldown_ns = (uint64_t)(cooldown_s * 1e9);
+  cfg.co_interval_ns = (uint64_t)(co_interval * 1e3);
+  if (cfg.warmup_threads == 0) {
+    cfg.warmup_threads = cfg.threads;
+  }
+  if (cfg.verify) {
+    cfg.shadow = (shadow_entry *)calloc((size_t)cfg.keyspace,
+                                        sizeof(*cfg.shadow));
+    if (!cfg.shadow) {
+      fprintf(stderr, "failed to allocate shadow map\n");
+      return 1;
+    }
+  }
+
+  if (cfg.interval_ns) {
+    pthread_condattr_t attr;
+    memset(&rep, 0, sizeof(rep));
+    rep.cfg = &cfg;
+    rep.format = format;
+    rep.out = format == FORMAT_TEXT ? stdout : stderr;
+    if (interval_path && !(rep.out = fopen(interval_path, "w"))) {
+      perror(interval_path);
+      return 1;
+    }
+    pthread_mutex_init(&rep.lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&rep.cond, &attr);
+    pthread_condattr_destroy(&attr);
+  }
+
+  // Thousands of connections need more descriptors than the usual soft limit.
+  {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+      rl.rlim_cur = rl.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &rl);
+    }
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  if (cfg.perf) {
+    perf_set probe;
+    if (perf_open(&probe) == 0) {
+      fprintf(stderr, "hardware counters unavailable: %s\n",
+              strerror(errno));
+    }
+    perf_close(&probe);
+  }
+
+  workers = (worker *)calloc((size_t)cfg.threads, sizeof(*workers));
+  if (!workers) {
+    fprintf(stderr, "failed to allocate workers\n");
+    return 1;
+  }
+  for (i = 0; i < cfg.threads; i++) {
+    worker *w = &workers[i];
+    w->cfg = &cfg;
+    w->id = i;
+    pthread_mutex_init(&w->iv_lock, NULL);
+    // Replayed records are dealt round-robin, which splits them the same way
+    // as worker_plan() splits the request count.
+    worker_plan(w);
+    w->trace_pos = (size_t)i;
+    w->rng = workload_seed((unsigned)i);
+    w->latest = (uint64_t)cfg.keyspace;
+    w->arr_rng = 0x7f4a7c15U + (unsigned)i * 0xc2b2ae35U;
+    w->val = (char *)malloc(cfg.body_cap);
+    w->body = (char *)malloc(cfg.body_cap);
+    w->set_body = (char *)malloc(cfg.body_cap);
+    w->reply = (char *)malloc(cfg.body_cap);
+    if (!w->val || !w->body || !w->set_body || !w->reply) {
+      fprintf(stderr, "failed to allocate worker buffers\n");
+      return 1;
+    }
+    if (cfg.engine == ENGINE_EPOLL) {
+      w->aconns = (aconn *)calloc((size_t)cfg.conns_per_thread,
+                                  sizeof(*w->aconns));
+      w->rbuf = (char *)malloc(RBUF_SIZE * 16);
+      if (!w->aconns || !w->rbuf) {
+        fprintf(stderr, "failed to allocate worker buffers\n");
+        return 1;
+      }
+      continue;
+    }
+    w->conns = (conn *)malloc((size_t)cfg.conns_per_thread * sizeof(conn));
+    w->pfds = (struct pollfd *)calloc((size_t)cfg.conns_per_thread,
+                                      sizeof(*w->pfds));
+    if (!w->conns || !w->pfds) {
+      fprintf(stderr, "failed to allocate worker buffers\n");
+      return 1;
+    }
+    for (j = 0; j < cfg.conns_per_thread; j++) {
+      if (conn_init(&w->conns[j], cfg.host, cfg.port, cfg.mode,
+                    cfg.pipeline) < 0) {
+        fprintf(stderr, "failed to allocate worker buffers\n");
+        return 1;
+      }
+    }
+  }
+
+  if (format == FORMAT_TEXT) {
+    print_config(&cfg, replay_path);
+  }
+
+  // Populate keys so get has a hit rate; timed apart from the run.
+  start_ns = now_ns();
+  res.warmup_failures = warm_up(&cfg);
+  res.warmup_seconds = (double)(now_ns() - start_ns) / 1e9;
+  if (format == FORMAT_TEXT) {
+    printf("Warm-up: %ld keys in %.3f s (%.0f sets/s, %ld connections)",
+           cfg.keyspace, res.warmup_seconds,
+           (double)cfg.keyspace / res.warmup_seconds,
+           cfg.warmup_threads < cfg.keyspace ? cfg.warmup_threads
+                                             : cfg.keyspace);
+    if (res.warmup_failures) {
+      printf(", %llu failed", (unsigned long long)res.warmup_failures);
+    }
+    printf("\n");
+  }
+
+  if (sweep.mode != SWEEP_NONE) {
+    if (run_sweep(&cfg, workers, cfg.interval_ns ? &rep : NULL, &sweep,
+                  format, replay_path) < 0) {
+      return 1;
+    }
+  } else {
+    if (run_phase(&cfg, workers, cfg.interval_ns ? &rep : NULL, m,
+                  cfg.co_correct ? co : NULL, &res) < 0) {
+      return 1;
+    }
+    print_results(&cfg, replay_path, m, cfg.co_correct ? co : NULL, &res,
+                  format);
+  }
+  if (interval_path) {
+    fclose(rep.out);
+  }
+
+  for (i = 0; i < cfg.threads; i++) {
+    for (j = 0; workers[i].conns && j < cfg.conns_per_thread; j++) {
+      conn_free(&workers[i].conns[j]);
+    }
+    free(workers[i].conns);
+    free(workers[i].aconns);
+    free(workers[i].rbuf);
+    free(workers[i].val);
+    free(workers[i].body);
+    free(workers[i].set_body);
+    free(workers[i].reply);
+    free(workers[i].pfds);
+    free(workers[i].pg_ops);
+    free(workers[i].pg_frames);
+    free(workers[i].pg_arena);
+  }
+  free(workers);
+  value_dist_free(&cfg.values);
+  free(cfg.shadow);
+  if (cfg.replay) {
+    trace_free(&replay);
+  }
+
+  if (res.mismatches + res.stale + res.misses) {
+    return 3;
+  }
+  return res.failures + res.warmup_failures == 0 ? 0 : 2;
 }
@@ -0,0 +1,91 @@
+#ifndef BENCHCACHED_HASH_H
+#define BENCHCACHED_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Key hashes. Tables index with hash & (size - 1), so only the low bits
+// matter to them; hashbench measures speed and how well those bits mix.
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// FNV-1a over a NUL-terminated key, as the server and the engines use it.
+static inline uint64_t fnv_hash(const char *s) {
+  uint64_t hash = FNV_OFFSET;
+  while (*s) {
+    hash ^= (uint64_t)(unsigned char)(*s++);
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static inline uint64_t hash_fnv1a(const void *key, size_t len) {
+  const unsigned char *p = (const unsigned char *)key;
+  uint64_t hash = FNV_OFFSET;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+// MurmurHash3's 64-bit finalizer: every input bit reaches every output bit.
+static inline uint64_t hash_fmix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// FNV-1a only carries input bits upwards, so the low bits a mask keeps never
+// see the top of the last bytes; the finalizer mixes them back down.
+static inline uint64_t hash_fnv1a_fmix(const void *key, size_t len) {
+  return hash_fmix64(hash_fnv1a(key, len));
+}
+
+// MurmurHash64A: eight bytes per multiply instead of one.
+static inline uint64_t hash_murmur64a(const void *key, size_t len) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const unsigned char *p = (const unsigned char *)key;
+  const unsigned char *end = p + (len & ~(size_t)7);
+  uint64_t h = 0x8445d61a4e774912ULL ^ ((uint64_t)len * m);
+  size_t tail = len & 7;
+
+  for (; p != end; p += 8) {
+    uint64_t k;
+    memcpy(&k, p, sizeof(k));
+    k *= m;
+    k ^= k >> 47;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  if (tail) {
+    while (tail--) {
+      h ^= (uint64_t)p[tail] << (8 * tail);
+    }
+    h *= m;
+  }
+  h ^= h >> 47;
+  h *= m;
+  h ^= h >> 47;
+  return h;
+}
+
+// djb2 (hash * 33 + c), the classic string hash.
+static inline uint64_t hash_djb2(const void *key, size_t len) {
+  const unsigned char *p = (const unsigned char *)key;
+  uint64_t hash = 5381;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    hash = hash * 33 + p[i];
+  }
+  return hash;
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "hist.h"
+
+#include <math.h>
+#include <stdio.h>
+
+static unsigned hist_index(uint64_t v) {
+  unsigned msb, shift;
+  if (v < HIST_SUB_COUNT) {
+    return (unsigned)v;
+  }
+  msb = 63U - (unsigned)__builtin_clzll(v);
+  if (msb >= HIST_MAX_BITS) {
+    return HIST_BUCKETS - 1;
+  }
+  shift = msb - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB_COUNT +
+         (unsigned)((v >> shift) - HIST_SUB_COUNT);
+}
+
+// Highest value that maps to bucket idx.
+static uint64_t hist_value(unsigned idx) {
+  unsigned shift;
+  uint64_t sub;
+  if (idx < HIST_SUB_COUNT) {
+    return idx;
+  }
+  shift = idx / HIST_SUB_COUNT - 1;
+  sub = HIST_SUB_COUNT + idx % HIST_SUB_COUNT;
+  return ((sub + 1) << shift) - 1;
+}
+
+void record(metric *m, uint64_t elapsed_ns) {
+  if (m->count == 0 || elapsed_ns < m->min_ns) {
+    m->min_ns = elapsed_ns;
+  }
+  if (elapsed_ns > m->max_ns) {
+    m->max_ns = elapsed_ns;
+  }
+  m->count++;
+  m->total_ns += elapsed_ns;
+  m->buckets[hist_index(elapsed_ns)]++;
+}
+
+void record_corrected(metric *m, uint64_t elapsed_ns,
+                      uint64_t interval_ns) {
+  uint64_t missing;
+
+  record(m, elapsed_ns);
+  if (interval_ns == 0 || elapsed_ns <= interval_ns) {
+    return;
+  }
+  for (missing = elapsed_ns - interval_ns; missing >= interval_ns;
+       missing -= interval_ns) {
+    record(m, missing);
+  }
+}
+
+void metric_merge(metric *dst, const metric *src) {
+  unsigned i;
+  if (src->count == 0) {
+    return;
+  }
+  if (dst->count == 0 || src->min_ns < dst->min_ns) {
+    dst->min_ns = src->min_ns;
+  }
+  if (src->max_ns > dst->max_ns) {
+    dst->max_ns = src->max_ns;
+  }
+  dst->count += src->count;
+  dst->total_ns += src->total_ns;
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    dst->buckets[i] += src->buckets[i];
+  }
+}
+
+uint64_t metric_percentile(const metric *m, double q) {
+  uint64_t rank, seen = 0;
+  unsigned i;
+  if (m->count == 0) {
+    return 0;
+  }
+  rank = (uint64_t)ceil(q * (double)m->count);
+  if (rank == 0) {
+    rank = 1;
+  }
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    seen += m->buckets[i];
+    if (seen >= rank) {
+      uint64_t v = hist_value(i);
+      return v < m->max_ns ? v : m->max_ns;
+    }
+  }
+  return m->max_ns;
+}
+
+void print_metric(const char *name, const metric *m) {
+  if (!m->count) {
+    return;
+  }
+  printf("  %s avg: %.3f us (%llu ops)\n", name,
+         ((double)m->total_ns / (double)m->count) / 1e3,
+         (unsigned long long)m->count);
+  printf("    p50: %.3f  p90: %.3f  p99: %.3f  p99.9: %.3f  p99.99: %.3f  "
+         "max: %.3f us\n",
+         (double)metric_percentile(m, 0.50) / 1e3,
+         (double)metric_percentile(m, 0.90) / 1e3,
+         (double)metric_percentile(m, 0.99) / 1e3,
+         (double)metric_percentile(m, 0.999) / 1e3,
+         (double)metric_percentile(m, 0.9999) / 1e3,
+         (double)m->max_ns / 1e3);
+}
+
+double metric_avg_us(const metric *m) {
+  return m->count ? ((double)m->total_ns / (double)m->count) / 1e3 : 0.0;
+}
@@ -0,0 +1,39 @@
+#ifndef BENCHCACHED_HIST_H
+#define BENCHCACHED_HIST_H
+
+#include <stdint.h>
+
+// Log-linear latency histogram (HDR style): values below 2^HIST_SUB_BITS are
+// exact, above that every power of two is split into 2^HIST_SUB_BITS
+// sub-buckets, bounding the relative error to under 1%.
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1U << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40 // ~18 minutes in ns; larger values are clamped
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  uint64_t buckets[HIST_BUCKETS];
+} metric;
+
+void record(metric *m, uint64_t elapsed_ns);
+
+// Coordinated-omission correction, as HdrHistogram's
+// recordValueWithExpectedInterval(): a closed-loop sender stuck behind one
+// slow reply did not send the requests due every interval_ns meanwhile, so
+// back-fill the latencies those would have seen.
+void record_corrected(metric *m, uint64_t elapsed_ns, uint64_t interval_ns);
+
+void metric_merge(metric *dst, const metric *src);
+
+// Value at quantile q (0..1], never reported above the observed maximum.
+uint64_t metric_percentile(const metric *m, double q);
+
+double metric_avg_us(const metric *m);
+
+void print_metric(const char *name, const metric *m);
+
+#endif
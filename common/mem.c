@@ -0,0 +1,78 @@
+#include "mem.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <unistd.h>
+
+size_t mem_alloc_bytes(const void *p) {
+  return p ? malloc_usable_size((void *)p) + sizeof(size_t) : 0;
+}
+
+size_t mem_rss_bytes(void) {
+  FILE *fp = fopen("/proc/self/statm", "r");
+  unsigned long size, resident;
+  int n;
+
+  if (!fp) {
+    return 0;
+  }
+  n = fscanf(fp, "%lu %lu", &size, &resident);
+  fclose(fp);
+  return n == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+}
+
+static size_t mem_overhead(const mem_report *m) {
+  return m->alloc_bytes - m->table_bytes - m->item_bytes;
+}
+
+static double mem_per_key(const mem_report *m) {
+  return m->keys ? (double)m->alloc_bytes / (double)m->keys : 0.0;
+}
+
+// RSS only moves in whole pages, counts everything else the process touched
+// meanwhile, and can even shrink if the kernel reclaimed something.
+static double mem_rss_per_key(const mem_report *m) {
+  return m->keys ? ((double)m->rss_after - (double)m->rss_before) /
+                       (double)m->keys
+                 : 0.0;
+}
+
+void print_mem(const mem_report *m) {
+  printf("  Memory: %zu keys, table %.2f MiB, items %.2f MiB, allocator "
+         "overhead %.2f MiB\n",
+         m->keys, (double)m->table_bytes / 1048576.0,
+         (double)m->item_bytes / 1048576.0,
+         (double)mem_overhead(m) / 1048576.0);
+  printf("    RSS %.2f MiB before load, %.2f MiB after; %.1f bytes per key "
+         "(%.1f by RSS)\n",
+         (double)m->rss_before / 1048576.0, (double)m->rss_after / 1048576.0,
+         mem_per_key(m), mem_rss_per_key(m));
+}
+
+void json_mem(const mem_report *m) {
+  printf("\"memory\":{\"keys\":%zu,\"table_bytes\":%zu,\"item_bytes\":%zu,"
+         "\"overhead_bytes\":%zu,\"rss_before\":%zu,\"rss_after\":%zu,"
+         "\"bytes_per_key\":%.2f,\"rss_bytes_per_key\":%.2f}",
+         m->keys, m->table_bytes, m->item_bytes, mem_overhead(m),
+         m->rss_before, m->rss_after, mem_per_key(m), mem_rss_per_key(m));
+}
+
+void csv_mem_header(void) {
+  printf("mem_keys,table_bytes,item_bytes,overhead_bytes,rss_before,"
+         "rss_after,bytes_per_key,rss_bytes_per_key");
+}
+
+void csv_mem(const mem_report *m) {
+  printf("%zu,%zu,%zu,%zu,%zu,%zu,%.2f,%.2f", m->keys, m->table_bytes,
+         m->item_bytes, mem_overhead(m), m->rss_before, m->rss_after,
+         mem_per_key(m), mem_rss_per_key(m));
+}
+
+void mem_format(const mem_report *m, char *buf, size_t cap) {
+  snprintf(buf, cap,
+           "keys=%zu table_bytes=%zu item_bytes=%zu overhead_bytes=%zu "
+           "rss_before=%zu rss_after=%zu bytes_per_key=%.1f "
+           "rss_bytes_per_key=%.1f",
+           m->keys, m->table_bytes, m->item_bytes, mem_overhead(m),
+           m->rss_before, m->rss_after, mem_per_key(m), mem_rss_per_key(m));
+}
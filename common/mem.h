@@ -0,0 +1,37 @@
+#ifndef BENCHCACHED_MEM_H
+#define BENCHCACHED_MEM_H
+
+#include <stddef.h>
+
+// Memory footprint of a loaded map. The byte counts are the sizes asked of
+// the allocator, split into the index (slots, buckets) and the items (keys,
+// values, per-item nodes); alloc_bytes is what the allocator really spent
+// on the same blocks, so the difference is its overhead.
+typedef struct {
+  size_t keys;
+  size_t table_bytes;
+  size_t item_bytes;
+  size_t alloc_bytes;
+  size_t rss_before; // process RSS before the map was created
+  size_t rss_after;  // and once it was loaded
+} mem_report;
+
+// Heap a block from malloc() takes: its usable size plus the chunk header
+// glibc keeps in front of it. 0 for NULL.
+size_t mem_alloc_bytes(const void *p);
+
+// Resident set size of the process, 0 if /proc isn't there.
+size_t mem_rss_bytes(void);
+
+void print_mem(const mem_report *m);
+
+void json_mem(const mem_report *m);
+
+void csv_mem_header(void);
+
+void csv_mem(const mem_report *m);
+
+// One line of "name=value" pairs, with the json_mem names, into buf.
+void mem_format(const mem_report *m, char *buf, size_t cap);
+
+#endif
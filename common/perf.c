@@ -0,0 +1,194 @@
+#include "perf.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char *const perf_fields[PERF_COUNT] = {
+    "cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses"};
+
+static const char *const perf_names[PERF_COUNT] = {
+    "cycles", "instructions", "LLC misses", "dTLB misses", "branch misses"};
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} perf_events[PERF_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                             (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+int perf_open(perf_set *p) {
+  int n = 0, err = 0;
+  unsigned i;
+
+  for (i = 0; i < PERF_COUNT; i++) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = perf_events[i].type;
+    attr.config = perf_events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    p->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (p->fd[i] < 0) {
+      err = errno;
+    } else {
+      n++;
+    }
+  }
+  if (!n) {
+    errno = err;
+  }
+  return n;
+}
+
+void perf_enable(const perf_set *p) {
+  unsigned i;
+  for (i = 0; i < PERF_COUNT; i++) {
+    if (p->fd[i] >= 0) {
+      ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+void perf_disable(const perf_set *p) {
+  unsigned i;
+  for (i = 0; i < PERF_COUNT; i++) {
+    if (p->fd[i] >= 0) {
+      ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+}
+
+void perf_read(const perf_set *p, perf_counts *c) {
+  unsigned i;
+
+  for (i = 0; i < PERF_COUNT; i++) {
+    uint64_t v[3]; // value, time enabled, time running
+
+    if (p->fd[i] < 0 || read(p->fd[i], v, sizeof(v)) != sizeof(v)) {
+      continue;
+    }
+    if (v[2] && v[2] < v[1]) {
+      v[0] = (uint64_t)((double)v[0] * (double)v[1] / (double)v[2]);
+    }
+    c->count[i] += v[0];
+    c->valid |= 1U << i;
+  }
+}
+
+void perf_close(perf_set *p) {
+  unsigned i;
+  for (i = 0; i < PERF_COUNT; i++) {
+    if (p->fd[i] >= 0) {
+      close(p->fd[i]);
+      p->fd[i] = -1;
+    }
+  }
+}
+
+void perf_merge(perf_counts *dst, const perf_counts *src) {
+  unsigned i;
+  for (i = 0; i < PERF_COUNT; i++) {
+    dst->count[i] += src->count[i];
+  }
+  dst->valid |= src->valid;
+}
+
+static int perf_has(const perf_counts *c, perf_counter i) {
+  return (c->valid >> i) & 1;
+}
+
+static double perf_ipc(const perf_counts *c) {
+  return (double)c->count[PERF_INSTRUCTIONS] / (double)c->count[PERF_CYCLES];
+}
+
+static int perf_has_ipc(const perf_counts *c) {
+  return perf_has(c, PERF_CYCLES) && perf_has(c, PERF_INSTRUCTIONS) &&
+         c->count[PERF_CYCLES];
+}
+
+void print_perf(const perf_counts *c, double ops) {
+  unsigned i;
+
+  printf("  Counters per op (user space):");
+  if (!c->valid) {
+    printf(" unavailable\n");
+    return;
+  }
+  for (i = 0; i < PERF_COUNT; i++) {
+    if (perf_has(c, (perf_counter)i)) {
+      printf("%s %.3f %s", i ? "," : "", (double)c->count[i] / ops,
+             perf_names[i]);
+    } else {
+      printf("%s %s n/a", i ? "," : "", perf_names[i]);
+    }
+  }
+  if (perf_has_ipc(c)) {
+    printf(" (IPC %.2f)", perf_ipc(c));
+  }
+  printf("\n");
+}
+
+void json_perf(const perf_counts *c, double ops) {
+  unsigned i;
+
+  printf("\"perf\":{");
+  for (i = 0; i < PERF_COUNT; i++) {
+    if (perf_has(c, (perf_counter)i)) {
+      printf("%s\"%s\":%llu,\"%s_per_op\":%.3f", i ? "," : "",
+             perf_fields[i], (unsigned long long)c->count[i], perf_fields[i],
+             (double)c->count[i] / ops);
+    } else {
+      printf("%s\"%s\":null,\"%s_per_op\":null", i ? "," : "", perf_fields[i],
+             perf_fields[i]);
+    }
+  }
+  if (perf_has_ipc(c)) {
+    printf(",\"ipc\":%.3f}", perf_ipc(c));
+  } else {
+    printf(",\"ipc\":null}");
+  }
+}
+
+void csv_perf_header(void) {
+  unsigned i;
+  for (i = 0; i < PERF_COUNT; i++) {
+    printf("%s%s,%s_per_op", i ? "," : "", perf_fields[i], perf_fields[i]);
+  }
+  printf(",ipc");
+}
+
+// Unavailable counters are empty fields.
+void csv_perf(const perf_counts *c, double ops) {
+  unsigned i;
+  for (i = 0; i < PERF_COUNT; i++) {
+    if (perf_has(c, (perf_counter)i)) {
+      printf("%s%llu,%.3f", i ? "," : "", (unsigned long long)c->count[i],
+             (double)c->count[i] / ops);
+    } else {
+      printf("%s,", i ? "," : "");
+    }
+  }
+  if (perf_has_ipc(c)) {
+    printf(",%.3f", perf_ipc(c));
+  } else {
+    printf(",");
+  }
+}
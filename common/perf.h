@@ -0,0 +1,55 @@
+#ifndef BENCHCACHED_PERF_H
+#define BENCHCACHED_PERF_H
+
+#include <stdint.h>
+
+// Hardware counters (--perf) through perf_event_open(2). Each set counts the
+// thread that opened it, in user space only, so it works at the default
+// perf_event_paranoid level; counters the CPU or kernel doesn't offer are
+// left out and reported as unavailable.
+typedef enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_LLC_MISSES,
+  PERF_DTLB_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_COUNT,
+} perf_counter;
+
+extern const char *const perf_fields[PERF_COUNT];
+
+typedef struct {
+  int fd[PERF_COUNT]; // -1 if unavailable
+} perf_set;
+
+typedef struct {
+  uint64_t count[PERF_COUNT]; // scaled up if the kernel multiplexed them
+  unsigned valid;             // bit per counter
+} perf_counts;
+
+// Opens the counters of the calling thread, stopped. Returns how many could
+// be opened, with errno from the last failure if that's none.
+int perf_open(perf_set *p);
+
+void perf_enable(const perf_set *p);
+
+void perf_disable(const perf_set *p);
+
+// Adds everything counted so far to c.
+void perf_read(const perf_set *p, perf_counts *c);
+
+void perf_close(perf_set *p);
+
+void perf_merge(perf_counts *dst, const perf_counts *src);
+
+// Reports c averaged over ops operations.
+void print_perf(const perf_counts *c, double ops);
+
+// "perf":{...} with totals and per-op averages, unavailable counters null.
+void json_perf(const perf_counts *c, double ops);
+
+void csv_perf_header(void);
+
+void csv_perf(const perf_counts *c, double ops);
+
+#endif
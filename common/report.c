@@ -0,0 +1,165 @@
+#include "report.h"
+
+#include <string.h>
+#include <unistd.h>
+
+const char *const op_fields[OP_COUNT] = {"get", "set", "del", "scan",
+                                         "rmw"};
+const double report_q[REPORT_Q_COUNT] = {0.50, 0.90, 0.99, 0.999, 0.9999};
+const char *const report_q_names[REPORT_Q_COUNT] = {"p50", "p90", "p99",
+                                                    "p99_9", "p99_99"};
+
+int format_parse(output_format *f, const char *name) {
+  if (strcmp(name, "text") == 0) {
+    *f = FORMAT_TEXT;
+  } else if (strcmp(name, "json") == 0) {
+    *f = FORMAT_JSON;
+  } else if (strcmp(name, "csv") == 0) {
+    *f = FORMAT_CSV;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+void host_info_get(host_info *h) {
+  memset(h, 0, sizeof(*h));
+  if (gethostname(h->hostname, sizeof(h->hostname) - 1) < 0) {
+    strcpy(h->hostname, "unknown");
+  }
+  uname(&h->uts);
+  h->cpus = sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+void json_string(const char *s) {
+  putchar('"');
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    } else if (c < 0x20) {
+      printf("\\u%04x", c);
+    } else {
+      putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+void csv_string(const char *s) {
+  if (!strpbrk(s, ",\"\r\n")) {
+    fputs(s, stdout);
+    return;
+  }
+  putchar('"');
+  for (; *s; s++) {
+    if (*s == '"') {
+      putchar('"');
+    }
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+void json_host(const host_info *h) {
+  printf("\"host\":{\"hostname\":");
+  json_string(h->hostname);
+  printf(",\"os\":");
+  json_string(h->uts.sysname);
+  printf(",\"kernel\":");
+  json_string(h->uts.release);
+  printf(",\"machine\":");
+  json_string(h->uts.machine);
+  printf(",\"cpus\":%ld}", h->cpus);
+}
+
+void json_workload(const op_mix *mix, const key_dist *keys,
+                   const value_dist *values) {
+  unsigned op;
+  printf("\"workload\":{\"mix\":");
+  json_string(mix->name);
+  printf(",\"mix_pct\":{");
+  for (op = 0; op < OP_COUNT; op++) {
+    printf("%s\"%s\":%u", op ? "," : "", op_fields[op], mix->pct[op]);
+  }
+  printf("},\"keys\":");
+  json_string(key_dist_name(keys));
+  printf(",\"theta\":%g,\"hot_frac\":%g,\"hot_ops\":%g", keys->theta,
+         keys->hot_frac, keys->hot_ops);
+  printf(",\"values\":");
+  json_string(value_dist_name(values));
+  printf(",\"value_min\":%zu,\"value_max\":%zu}", values->min, values->max);
+}
+
+void json_metrics(FILE *fp, const metric *m) {
+  unsigned op, q;
+  fprintf(fp, "\"ops\":{");
+  for (op = 0; op < OP_COUNT; op++) {
+    fprintf(fp, "%s\"%s\":{\"count\":%llu,\"avg_us\":%.3f,\"min_us\":%.3f",
+            op ? "," : "", op_fields[op], (unsigned long long)m[op].count,
+            metric_avg_us(&m[op]), (double)m[op].min_ns / 1e3);
+    for (q = 0; q < REPORT_Q_COUNT; q++) {
+      fprintf(fp, ",\"%s_us\":%.3f", report_q_names[q],
+              (double)metric_percentile(&m[op], report_q[q]) / 1e3);
+    }
+    fprintf(fp, ",\"max_us\":%.3f}", (double)m[op].max_ns / 1e3);
+  }
+  fprintf(fp, "}");
+}
+
+void csv_host_header(void) {
+  printf("hostname,os,kernel,machine,cpus");
+}
+
+void csv_host(const host_info *h) {
+  csv_string(h->hostname);
+  putchar(',');
+  csv_string(h->uts.sysname);
+  putchar(',');
+  csv_string(h->uts.release);
+  putchar(',');
+  csv_string(h->uts.machine);
+  printf(",%ld", h->cpus);
+}
+
+void csv_workload_header(void) {
+  unsigned op;
+  printf("mix");
+  for (op = 0; op < OP_COUNT; op++) {
+    printf(",%s_pct", op_fields[op]);
+  }
+  printf(",keys,theta,hot_frac,hot_ops,values,value_min,value_max");
+}
+
+void csv_workload(const op_mix *mix, const key_dist *keys,
+                  const value_dist *values) {
+  unsigned op;
+  csv_string(mix->name);
+  for (op = 0; op < OP_COUNT; op++) {
+    printf(",%u", mix->pct[op]);
+  }
+  printf(",");
+  csv_string(key_dist_name(keys));
+  printf(",%g,%g,%g,%s,%zu,%zu", keys->theta, keys->hot_frac, keys->hot_ops,
+         value_dist_name(values), values->min, values->max);
+}
+
+void csv_metric_header(FILE *fp) {
+  unsigned q;
+  fprintf(fp, "op,count,avg_us,min_us");
+  for (q = 0; q < REPORT_Q_COUNT; q++) {
+    fprintf(fp, ",%s_us", report_q_names[q]);
+  }
+  fprintf(fp, ",max_us");
+}
+
+void csv_metric(FILE *fp, unsigned op, const metric *m) {
+  unsigned q;
+  fprintf(fp, "%s,%llu,%.3f,%.3f", op_fields[op],
+          (unsigned long long)m->count, metric_avg_us(m),
+          (double)m->min_ns / 1e3);
+  for (q = 0; q < REPORT_Q_COUNT; q++) {
+    fprintf(fp, ",%.3f", (double)metric_percentile(m, report_q[q]) / 1e3);
+  }
+  fprintf(fp, ",%.3f", (double)m->max_ns / 1e3);
+}
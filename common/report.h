@@ -0,0 +1,61 @@
+#ifndef BENCHCACHED_REPORT_H
+#define BENCHCACHED_REPORT_H
+
+#include <stdio.h>
+#include <sys/utsname.h>
+
+#include "hist.h"
+#include "workload.h"
+
+// Machine-readable results (--format json|csv). Field names and CSV columns
+// are a stable schema: fields are only ever appended, and RESULT_SCHEMA is
+// bumped if one has to change meaning.
+#define RESULT_SCHEMA 1
+
+typedef enum {
+  FORMAT_TEXT,
+  FORMAT_JSON,
+  FORMAT_CSV,
+} output_format;
+
+#define REPORT_Q_COUNT 5
+
+extern const char *const op_fields[OP_COUNT];
+extern const double report_q[REPORT_Q_COUNT];
+extern const char *const report_q_names[REPORT_Q_COUNT];
+
+typedef struct {
+  char hostname[256];
+  struct utsname uts;
+  long cpus;
+} host_info;
+
+int format_parse(output_format *f, const char *name);
+
+void host_info_get(host_info *h);
+
+void json_string(const char *s);
+
+void csv_string(const char *s);
+
+void json_host(const host_info *h);
+
+void json_workload(const op_mix *mix, const key_dist *keys,
+                   const value_dist *values);
+
+void json_metrics(FILE *fp, const metric *m);
+
+void csv_host_header(void);
+
+void csv_host(const host_info *h);
+
+void csv_workload_header(void);
+
+void csv_workload(const op_mix *mix, const key_dist *keys,
+                  const value_dist *values);
+
+void csv_metric_header(FILE *fp);
+
+void csv_metric(FILE *fp, unsigned op, const metric *m);
+
+#endif
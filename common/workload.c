@@ -0,0 +1,453 @@
+#include "workload.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static uint64_t fnv_hash_u64(uint64_t x) {
+  uint64_t hash = 14695981039346656037ULL;
+  int i;
+  for (i = 0; i < 8; i++) {
+    hash ^= x & 0xff;
+    hash *= 1099511628211ULL;
+    x >>= 8;
+  }
+  return hash;
+}
+
+// Uniform double in [0, 1) with 48 bits taken from two LCG steps.
+static double next_u01(unsigned *rng) {
+  uint64_t hi, lo;
+  lcg_next(rng);
+  hi = *rng >> 8;
+  lcg_next(rng);
+  lo = *rng >> 8;
+  return (double)((hi << 24) | lo) / 281474976710656.0;
+}
+
+// Generalized harmonic number H(n, theta). The first terms are summed
+// exactly and the tail uses Euler-Maclaurin, keeping setup O(1) even for
+// very large keyspaces.
+static double zeta(uint32_t n, double theta) {
+  const uint32_t exact = 1024;
+  uint32_t m = n < exact ? n : exact;
+  double sum = 0.0;
+  double a, b;
+  uint32_t i;
+
+  for (i = 1; i <= m; i++) {
+    sum += pow((double)i, -theta);
+  }
+  if (n == m) {
+    return sum;
+  }
+
+  a = (double)m + 1.0;
+  b = (double)n;
+  sum += (pow(b, 1.0 - theta) - pow(a, 1.0 - theta)) / (1.0 - theta);
+  sum += (pow(a, -theta) + pow(b, -theta)) / 2.0;
+  sum += theta * (pow(a, -theta - 1.0) - pow(b, -theta - 1.0)) / 12.0;
+  return sum;
+}
+
+int key_dist_parse(key_dist *d, const char *spec) {
+  const char *arg = strchr(spec, ':');
+  size_t name_len = arg ? (size_t)(arg - spec) : strlen(spec);
+
+  memset(d, 0, sizeof(*d));
+  d->theta = 0.99;
+  d->hot_frac = 0.2;
+  d->hot_ops = 0.8;
+
+  if (name_len == 7 && strncmp(spec, "uniform", 7) == 0) {
+    d->kind = KEYS_UNIFORM;
+    return arg ? -1 : 0;
+  }
+  if (name_len == 7 && strncmp(spec, "hotspot", 7) == 0) {
+    d->kind = KEYS_HOTSPOT;
+    if (arg && sscanf(arg + 1, "%lf:%lf", &d->hot_frac, &d->hot_ops) != 2) {
+      return -1;
+    }
+    return d->hot_frac > 0 && d->hot_frac <= 1 && d->hot_ops >= 0 &&
+                   d->hot_ops <= 1
+               ? 0
+               : -1;
+  }
+  if (name_len == 7 && strncmp(spec, "zipfian", 7) == 0) {
+    d->kind = KEYS_ZIPFIAN;
+  } else if (name_len == 9 && strncmp(spec, "scrambled", 9) == 0) {
+    d->kind = KEYS_SCRAMBLED;
+  } else if (name_len == 6 && strncmp(spec, "latest", 6) == 0) {
+    d->kind = KEYS_LATEST;
+  } else {
+    return -1;
+  }
+  if (arg && sscanf(arg + 1, "%lf", &d->theta) != 1) {
+    return -1;
+  }
+  return d->theta > 0 && d->theta < 1 ? 0 : -1;
+}
+
+void key_dist_init(key_dist *d, uint32_t n) {
+  d->n = n;
+  if (d->kind == KEYS_ZIPFIAN || d->kind == KEYS_SCRAMBLED ||
+      d->kind == KEYS_LATEST) {
+    double zeta2 = 1.0 + pow(0.5, d->theta);
+    d->alpha = 1.0 / (1.0 - d->theta);
+    d->zetan = zeta(n, d->theta);
+    d->eta = (1.0 - pow(2.0 / (double)n, 1.0 - d->theta)) /
+             (1.0 - zeta2 / d->zetan);
+    d->half_pow_theta = pow(0.5, d->theta);
+  }
+}
+
+static uint32_t zipf_next(const key_dist *d, unsigned *rng) {
+  double u = next_u01(rng);
+  double uz = u * d->zetan;
+  uint32_t r;
+
+  if (uz < 1.0) {
+    return 0;
+  }
+  if (uz < 1.0 + d->half_pow_theta) {
+    return d->n > 1 ? 1 : 0;
+  }
+  r = (uint32_t)((double)d->n * pow(d->eta * u - d->eta + 1.0, d->alpha));
+  return r < d->n ? r : d->n - 1;
+}
+
+const char *key_dist_name(const key_dist *d) {
+  switch (d->kind) {
+  case KEYS_ZIPFIAN:
+    return "zipfian";
+  case KEYS_SCRAMBLED:
+    return "scrambled zipfian";
+  case KEYS_HOTSPOT:
+    return "hotspot";
+  case KEYS_LATEST:
+    return "latest";
+  default:
+    return "uniform";
+  }
+}
+
+uint32_t key_dist_next(const key_dist *d, unsigned *rng, uint64_t *latest,
+                       int is_set) {
+  uint32_t hot;
+
+  switch (d->kind) {
+  case KEYS_ZIPFIAN:
+    return zipf_next(d, rng);
+  case KEYS_SCRAMBLED:
+    return (uint32_t)(fnv_hash_u64(zipf_next(d, rng)) % d->n);
+  case KEYS_HOTSPOT:
+    hot = (uint32_t)((double)d->n * d->hot_frac);
+    if (hot == 0) {
+      hot = 1;
+    }
+    if (hot >= d->n || next_u01(rng) < d->hot_ops) {
+      lcg_next(rng);
+      return *rng % hot;
+    }
+    lcg_next(rng);
+    return hot + *rng % (d->n - hot);
+  case KEYS_LATEST:
+    if (is_set) {
+      return (uint32_t)((*latest)++ % d->n);
+    }
+    return (uint32_t)((*latest - 1 - zipf_next(d, rng)) % d->n);
+  default:
+    lcg_next(rng);
+    return *rng % d->n;
+  }
+}
+
+// Loads "<size> [weight]" lines; blank lines and '#' comments are skipped.
+static int value_dist_load(value_dist *d, const char *path) {
+  FILE *fp = fopen(path, "r");
+  char line[256];
+  size_t cap = 0;
+  double total = 0.0;
+  size_t i;
+
+  if (!fp) {
+    perror(path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp)) {
+    unsigned long size;
+    double weight = 1.0;
+    char *p = line + strspn(line, " \t");
+    if (*p == '#' || *p == '\n' || *p == '\0') {
+      continue;
+    }
+    if (sscanf(p, "%lu %lf", &size, &weight) < 1 || size == 0 ||
+        size > VALUE_SIZE_MAX || weight < 0) {
+      fprintf(stderr, "%s: bad line: %s", path, line);
+      fclose(fp);
+      return -1;
+    }
+    if (d->n == cap) {
+      cap = cap ? cap * 2 : 16;
+      d->sizes = (size_t *)realloc(d->sizes, cap * sizeof(*d->sizes));
+      d->cdf = (double *)realloc(d->cdf, cap * sizeof(*d->cdf));
+      if (!d->sizes || !d->cdf) {
+        fclose(fp);
+        return -1;
+      }
+    }
+    total += weight;
+    d->sizes[d->n] = (size_t)size;
+    d->cdf[d->n] = total;
+    if ((size_t)size > d->max) {
+      d->max = (size_t)size;
+    }
+    d->n++;
+  }
+  fclose(fp);
+
+  if (d->n == 0 || total <= 0) {
+    fprintf(stderr, "%s: no value sizes\n", path);
+    return -1;
+  }
+  for (i = 0; i < d->n; i++) {
+    d->cdf[i] /= total;
+  }
+  return 0;
+}
+
+int value_dist_parse(value_dist *d, const char *spec) {
+  unsigned long a, b;
+  memset(d, 0, sizeof(*d));
+
+  if (strcmp(spec, "default") == 0) {
+    d->kind = VALUES_DEFAULT;
+    d->max = 16;
+    return 0;
+  }
+  if (sscanf(spec, "fixed:%lu", &a) == 1) {
+    d->kind = VALUES_FIXED;
+    d->min = d->max = (size_t)a;
+  } else if (sscanf(spec, "uniform:%lu:%lu", &a, &b) == 2 && a <= b) {
+    d->kind = VALUES_UNIFORM;
+    d->min = (size_t)a;
+    d->max = (size_t)b;
+  } else if (sscanf(spec, "normal:%lf:%lf", &d->mean, &d->stddev) == 2 &&
+             d->mean >= 1 && d->stddev >= 0) {
+    d->kind = VALUES_NORMAL;
+    d->min = 1;
+    d->max = VALUE_SIZE_MAX;
+  } else if (strncmp(spec, "file:", 5) == 0) {
+    d->kind = VALUES_EMPIRICAL;
+    return value_dist_load(d, spec + 5);
+  } else {
+    return -1;
+  }
+  return d->min >= 1 && d->max <= VALUE_SIZE_MAX ? 0 : -1;
+}
+
+size_t value_dist_next(const value_dist *d, unsigned *rng) {
+  double u, v, x;
+  size_t lo, hi;
+
+  switch (d->kind) {
+  case VALUES_FIXED:
+    return d->min;
+  case VALUES_UNIFORM:
+    return d->min + (size_t)(next_u01(rng) * (double)(d->max - d->min + 1));
+  case VALUES_NORMAL:
+    // Box-Muller.
+    u = 1.0 - next_u01(rng);
+    v = next_u01(rng);
+    x = d->mean + d->stddev * sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+    if (x < 1.0) {
+      return 1;
+    }
+    return x > (double)VALUE_SIZE_MAX ? VALUE_SIZE_MAX : (size_t)x;
+  case VALUES_EMPIRICAL:
+    u = next_u01(rng);
+    lo = 0;
+    hi = d->n - 1;
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      if (d->cdf[mid] <= u) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return d->sizes[lo];
+  default:
+    return 0;
+  }
+}
+
+void value_dist_print(const value_dist *d) {
+  switch (d->kind) {
+  case VALUES_FIXED:
+    printf("Values: fixed %zu bytes\n", d->min);
+    break;
+  case VALUES_UNIFORM:
+    printf("Values: uniform %zu..%zu bytes\n", d->min, d->max);
+    break;
+  case VALUES_NORMAL:
+    printf("Values: normal, mean %.0f stddev %.0f bytes\n", d->mean,
+           d->stddev);
+    break;
+  case VALUES_EMPIRICAL:
+    printf("Values: empirical, %zu sizes up to %zu bytes\n", d->n, d->max);
+    break;
+  default:
+    printf("Values: default (v<n>)\n");
+    break;
+  }
+}
+
+const char *value_dist_name(const value_dist *d) {
+  switch (d->kind) {
+  case VALUES_FIXED:
+    return "fixed";
+  case VALUES_UNIFORM:
+    return "uniform";
+  case VALUES_NORMAL:
+    return "normal";
+  case VALUES_EMPIRICAL:
+    return "empirical";
+  default:
+    return "default";
+  }
+}
+
+void value_dist_free(value_dist *d) {
+  free(d->sizes);
+  free(d->cdf);
+  d->sizes = NULL;
+  d->cdf = NULL;
+}
+
+size_t make_value(char *buf, uint32_t seed, size_t size) {
+  int n = snprintf(buf, 16, "v%u", seed);
+  if ((size_t)n >= size) {
+    return (size_t)n;
+  }
+  memset(buf + n, 'x', size - (size_t)n);
+  buf[size] = '\0';
+  return size;
+}
+
+const char *const op_names[OP_COUNT] = {"GET", "SET", "DEL", "SCAN",
+                                        "RMW"};
+
+// The default mix plus the YCSB core workloads A-F.
+static const op_mix mix_presets[] = {
+    {"default", {70, 20, 10, 0, 0}, KEYS_UNIFORM},
+    {"ycsb-a", {50, 50, 0, 0, 0}, KEYS_ZIPFIAN},  // update heavy
+    {"ycsb-b", {95, 5, 0, 0, 0}, KEYS_ZIPFIAN},   // read mostly
+    {"ycsb-c", {100, 0, 0, 0, 0}, KEYS_ZIPFIAN},  // read only
+    {"ycsb-d", {95, 5, 0, 0, 0}, KEYS_LATEST},    // read latest
+    {"ycsb-e", {0, 5, 0, 95, 0}, KEYS_ZIPFIAN},   // short ranges
+    {"ycsb-f", {50, 0, 0, 0, 50}, KEYS_ZIPFIAN},  // read-modify-write
+};
+
+int op_mix_parse(op_mix *mix, const char *spec) {
+  char buf[128];
+  char *tok, *save;
+  unsigned total = 0;
+  unsigned seen = 0; // bit per op already given a share
+  size_t i;
+
+  for (i = 0; i < sizeof(mix_presets) / sizeof(mix_presets[0]); i++) {
+    if (strcmp(spec, mix_presets[i].name) == 0) {
+      *mix = mix_presets[i];
+      return 0;
+    }
+  }
+
+  if (strlen(spec) >= sizeof(buf)) {
+    return -1;
+  }
+  strcpy(buf, spec);
+  memset(mix, 0, sizeof(*mix));
+  mix->name = "custom";
+  mix->keys = KEYS_UNIFORM;
+
+  for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    char *sep = strchr(tok, ':');
+    char *end;
+    long pct;
+    int found = 0;
+    unsigned op;
+    if (!sep) {
+      return -1;
+    }
+    *sep = '\0';
+    pct = strtol(sep + 1, &end, 10);
+    if (end == sep + 1 || *end != '\0' || pct < 0 || pct > 100) {
+      return -1;
+    }
+    for (op = 0; op < OP_COUNT; op++) {
+      if (strcasecmp(tok, op_names[op]) == 0) {
+        if (seen & (1U << op)) {
+          return -1;
+        }
+        seen |= 1U << op;
+        mix->pct[op] = (unsigned)pct;
+        total += mix->pct[op];
+        found = 1;
+      }
+    }
+    if (!found) {
+      return -1;
+    }
+  }
+  return total == 100 ? 0 : -1;
+}
+
+op_kind op_mix_pick(const op_mix *mix, uint32_t bucket) {
+  unsigned op, cut = 0;
+  for (op = 0; op < OP_COUNT - 1; op++) {
+    cut += mix->pct[op];
+    if (bucket < cut) {
+      break;
+    }
+  }
+  return (op_kind)op;
+}
+
+void print_mix(const op_mix *mix) {
+  unsigned op;
+  const char *sep = "";
+  printf("Mix: %s (", mix->name);
+  for (op = 0; op < OP_COUNT; op++) {
+    if (mix->pct[op]) {
+      printf("%s%s %u%%", sep, op_names[op], mix->pct[op]);
+      sep = ", ";
+    }
+  }
+  printf(")\n");
+}
+
+void workload_next(request *r, const op_mix *mix, const key_dist *keys,
+                   const value_dist *values, unsigned *rng, uint64_t *latest) {
+  r->op = op_mix_pick(mix, lcg_next(rng) % 100);
+  r->key_id = key_dist_next(keys, rng, latest, r->op == OP_SET);
+  r->seed = 0;
+  r->size = 0;
+  r->steps = 1;
+
+  switch (r->op) {
+  case OP_SET:
+  case OP_RMW:
+    r->seed = r->key_id ^ *rng;
+    r->size = (uint32_t)value_dist_next(values, rng);
+    r->steps = r->op == OP_RMW ? 2 : 1;
+    break;
+  case OP_SCAN:
+    r->steps = 1 + lcg_next(rng) % SCAN_MAX;
+    break;
+  default:
+    break;
+  }
+}
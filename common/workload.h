@@ -0,0 +1,136 @@
+#ifndef BENCHCACHED_WORKLOAD_H
+#define BENCHCACHED_WORKLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Workload generation shared by the client and standalone benchmarks, so
+// both draw byte-identical request streams from the same seed.
+
+#define KEY_MAX 64
+#define VALUE_SIZE_MAX (4U << 20) // largest generated value
+#define SCAN_MAX 100 // longest scan, as in YCSB workload E
+
+// Tiny LCG for reproducible pseudo-random workload.
+static inline unsigned lcg_next(unsigned *rng) {
+  *rng = *rng * 1664525U + 1013904223U;
+  return *rng;
+}
+
+// Seed of thread i's request stream: distinct and reproducible per thread,
+// with thread 0 drawing the single-threaded sequence.
+static inline unsigned workload_seed(unsigned thread) {
+  return 0x9e3779b9U + thread * 0x85ebca6bU;
+}
+
+typedef enum {
+  KEYS_UNIFORM,
+  KEYS_ZIPFIAN,   // rank 0 is the hottest key
+  KEYS_SCRAMBLED, // zipfian with ranks hashed across the keyspace
+  KEYS_HOTSPOT,   // hot_ops of requests go to the first hot_frac of keys
+  KEYS_LATEST,    // sets insert sequentially, reads favour recent inserts
+} key_dist_kind;
+
+typedef struct {
+  key_dist_kind kind;
+  uint32_t n;
+  double theta;
+  double hot_frac;
+  double hot_ops;
+  // Zipfian constants (Gray et al., "Quickly generating billion-record
+  // synthetic databases"), so sampling is O(1) with no per-key tables.
+  double alpha;
+  double zetan;
+  double eta;
+  double half_pow_theta;
+} key_dist;
+
+// Parses "uniform", "zipfian[:theta]", "scrambled[:theta]",
+// "hotspot[:hot_frac:hot_ops]" or "latest[:theta]".
+int key_dist_parse(key_dist *d, const char *spec);
+
+void key_dist_init(key_dist *d, uint32_t n);
+
+const char *key_dist_name(const key_dist *d);
+
+// Picks the next key id. latest counts sequential inserts and is only used
+// by KEYS_LATEST; is_set tells whether the key is for a write.
+uint32_t key_dist_next(const key_dist *d, unsigned *rng, uint64_t *latest,
+                       int is_set);
+
+typedef enum {
+  VALUES_DEFAULT,   // short "v<n>" values, as the benchmark always used
+  VALUES_FIXED,     // every value exactly min bytes
+  VALUES_UNIFORM,   // uniform in [min, max]
+  VALUES_NORMAL,    // normal(mean, stddev), clamped to [1, VALUE_SIZE_MAX]
+  VALUES_EMPIRICAL, // weighted sizes loaded from a file
+} value_dist_kind;
+
+typedef struct {
+  value_dist_kind kind;
+  size_t min;
+  size_t max; // largest size the distribution can return
+  double mean;
+  double stddev;
+  size_t n;       // empirical: number of sizes
+  size_t *sizes;  // empirical: sizes
+  double *cdf;    // empirical: cumulative weights, normalised to 1
+} value_dist;
+
+// Parses "fixed:N", "uniform:MIN:MAX", "normal:MEAN:STDDEV" or "file:PATH".
+int value_dist_parse(value_dist *d, const char *spec);
+
+size_t value_dist_next(const value_dist *d, unsigned *rng);
+
+void value_dist_print(const value_dist *d);
+
+const char *value_dist_name(const value_dist *d);
+
+void value_dist_free(value_dist *d);
+
+// Writes a value of the given size into buf: the usual "v<seed>" prefix,
+// padded with filler bytes. size 0 means the short default value. buf must
+// hold at least max(size, 16) + 1 bytes.
+size_t make_value(char *buf, uint32_t seed, size_t size);
+
+typedef enum {
+  OP_GET,
+  OP_SET,
+  OP_DEL,
+  OP_SCAN, // get over a short run of consecutive keys
+  OP_RMW,  // get followed by a set of the same key
+  OP_COUNT,
+} op_kind;
+
+extern const char *const op_names[OP_COUNT];
+
+// Operation mix as percentages; ops are picked from one draw in [0, 100).
+typedef struct {
+  const char *name;
+  unsigned pct[OP_COUNT];
+  key_dist_kind keys; // request distribution the preset was defined with
+} op_mix;
+
+// Parses a preset name or a list such as "get:50,set:40,del:10". Percentages
+// must add up to 100.
+int op_mix_parse(op_mix *mix, const char *spec);
+
+op_kind op_mix_pick(const op_mix *mix, uint32_t bucket);
+
+void print_mix(const op_mix *mix);
+
+// One operation drawn from the workload.
+typedef struct {
+  op_kind op;
+  uint32_t key_id;
+  uint32_t seed;  // set/rmw: value seed
+  uint32_t size;  // set/rmw: value size (0 = default value)
+  uint32_t steps; // requests the op issues: scan length, 2 for rmw, else 1
+} request;
+
+// Draws the next operation. The draw order matches what the request loops
+// have always used, so a given seed gives the same stream.
+void workload_next(request *r, const op_mix *mix, const key_dist *keys,
+                   const value_dist *values, unsigned *rng, uint64_t *latest);
+
+#endif
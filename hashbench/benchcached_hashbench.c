@@ -0,0 +1,351 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash.h"
+#include "report.h"
+#include "workload.h"
+
+#define HASHES_DEFAULT 2000000 // hashes per speed measurement
+#define BUCKET_BITS_DEFAULT 16
+#define KEYS_PER_BUCKET 4 // keys thrown at the table in the chi-square
+#define AVALANCHE_TRIALS 1000 // random keys per avalanche matrix
+#define KEY_POOL 4096 // distinct keys cycled through for throughput
+#define KEY_LEN_MAX 256
+
+typedef struct {
+  const char *name;
+  uint64_t (*fn)(const void *key, size_t len);
+} hash_func;
+
+static const hash_func hash_funcs[] = {
+    {"fnv1a", hash_fnv1a},
+    {"fnv1a-fmix", hash_fnv1a_fmix},
+    {"murmur64a", hash_murmur64a},
+    {"djb2", hash_djb2},
+};
+
+#define HASH_COUNT (sizeof(hash_funcs) / sizeof(hash_funcs[0]))
+
+static const size_t key_lens[] = {8, 16, 32, 64, 128, 256};
+
+#define LEN_COUNT (sizeof(key_lens) / sizeof(key_lens[0]))
+
+typedef struct {
+  long hashes;
+  unsigned bucket_bits;
+} hash_config;
+
+// One hash at one key length.
+typedef struct {
+  double mhash_s;    // independent keys: throughput
+  double gb_s;
+  double latency_ns; // each key depends on the previous hash
+  double chi2_df;    // random keys over the masked buckets; 1 is uniform
+  double aval_mean;  // P(a masked output bit flips | one input bit flips)
+  double aval_worst; // largest |P - 0.5| over input and masked output bits
+} hash_result;
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "%s [options]\n"
+          "\n"
+          "Measures every built-in key hash at key lengths of 8 to 256 "
+          "bytes:\n"
+          "throughput, latency, and how evenly and thoroughly the low bits a\n"
+          "power-of-two table keeps are mixed.\n"
+          "\n"
+          "Options:\n"
+          "  -n, --hashes N       hashes per speed measurement (default "
+          "2000000)\n"
+          "  -b, --bucket-bits B  table of 2^B buckets for the distribution "
+          "checks\n"
+          "                       (default 16)\n"
+          "  -f, --format FMT     results as text (default), json or csv\n",
+          prog);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void random_bytes(unsigned char *p, size_t n, unsigned *rng) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    p[i] = (unsigned char)(lcg_next(rng) >> 24); // the low bits cycle fast
+  }
+}
+
+// Throughput hashes a pool of independent keys; latency makes every key
+// depend on the hash before it, so calls can't overlap.
+static void measure_speed(const hash_func *h, size_t len, long hashes,
+                          const unsigned char *pool, hash_result *r) {
+  unsigned char key[KEY_LEN_MAX];
+  volatile uint64_t sink;
+  uint64_t acc = 0, t0, t1;
+  long i;
+
+  t0 = now_ns();
+  for (i = 0; i < hashes; i++) {
+    acc += h->fn(pool + (size_t)(i % KEY_POOL) * len, len);
+  }
+  t1 = now_ns();
+  sink = acc;
+  r->mhash_s = (double)hashes / ((double)(t1 - t0) / 1e9) / 1e6;
+  r->gb_s = r->mhash_s * 1e6 * (double)len / 1e9;
+
+  memcpy(key, pool, len);
+  t0 = now_ns();
+  for (i = 0; i < hashes; i++) {
+    acc = h->fn(key, len);
+    key[0] = (unsigned char)acc;
+  }
+  t1 = now_ns();
+  sink = acc;
+  (void)sink;
+  r->latency_ns = (double)(t1 - t0) / (double)hashes;
+}
+
+// Pearson's chi-square over the buckets, divided by its degrees of freedom.
+static double chi2_df(const uint32_t *counts, size_t buckets, size_t keys) {
+  double expect = (double)keys / (double)buckets;
+  double chi2 = 0;
+  size_t i;
+  for (i = 0; i < buckets; i++) {
+    double d = (double)counts[i] - expect;
+    chi2 += d * d / expect;
+  }
+  return chi2 / (double)(buckets - 1);
+}
+
+static double chi2_random(const hash_func *h, size_t len, unsigned bits,
+                          uint32_t *counts) {
+  size_t buckets = (size_t)1 << bits;
+  size_t keys = buckets * KEYS_PER_BUCKET;
+  uint64_t mask = buckets - 1;
+  unsigned char key[KEY_LEN_MAX];
+  unsigned rng = 0x9e3779b9U ^ (unsigned)len;
+  size_t i;
+
+  memset(counts, 0, buckets * sizeof(*counts));
+  for (i = 0; i < keys; i++) {
+    random_bytes(key, len, &rng);
+    counts[h->fn(key, len) & mask]++;
+  }
+  return chi2_df(counts, buckets, keys);
+}
+
+// The benchmarks' own keys, "k0", "k1", ...: short and nearly identical.
+static double chi2_keys(const hash_func *h, unsigned bits, uint32_t *counts) {
+  size_t buckets = (size_t)1 << bits;
+  size_t keys = buckets * KEYS_PER_BUCKET;
+  uint64_t mask = buckets - 1;
+  char key[KEY_MAX];
+  size_t i;
+
+  memset(counts, 0, buckets * sizeof(*counts));
+  for (i = 0; i < keys; i++) {
+    int n = snprintf(key, sizeof(key), "k%zu", i);
+    counts[h->fn(key, (size_t)n) & mask]++;
+  }
+  return chi2_df(counts, buckets, keys);
+}
+
+// Flips every input bit of random keys and counts which of the masked
+// output bits follow. flips holds len * 8 * bits counters.
+static void avalanche(const hash_func *h, size_t len, unsigned bits,
+                      uint32_t *flips, hash_result *r) {
+  unsigned char key[KEY_LEN_MAX];
+  unsigned rng = 0x2545f491U ^ (unsigned)len;
+  size_t in_bits = len * 8, i, j;
+  double sum = 0, worst = 0;
+  int t;
+
+  memset(flips, 0, in_bits * bits * sizeof(*flips));
+  for (t = 0; t < AVALANCHE_TRIALS; t++) {
+    uint64_t base;
+    random_bytes(key, len, &rng);
+    base = h->fn(key, len);
+    for (i = 0; i < in_bits; i++) {
+      uint64_t diff;
+      key[i / 8] ^= (unsigned char)(1U << (i % 8));
+      diff = base ^ h->fn(key, len);
+      key[i / 8] ^= (unsigned char)(1U << (i % 8));
+      for (j = 0; j < bits; j++) {
+        flips[i * bits + j] += (diff >> j) & 1;
+      }
+    }
+  }
+  for (i = 0; i < in_bits * bits; i++) {
+    double p = (double)flips[i] / AVALANCHE_TRIALS;
+    sum += p;
+    if (fabs(p - 0.5) > worst) {
+      worst = fabs(p - 0.5);
+    }
+  }
+  r->aval_mean = sum / (double)(in_bits * bits);
+  r->aval_worst = worst;
+}
+
+static void print_json(const hash_config *cfg,
+                       hash_result res[][LEN_COUNT], const double *keys) {
+  host_info h;
+  size_t f, l;
+
+  host_info_get(&h);
+  printf("{\"schema\":%d,\"benchmark\":\"hash\",", RESULT_SCHEMA);
+  json_host(&h);
+  printf(",\"config\":{\"hashes\":%ld,\"bucket_bits\":%u,"
+         "\"keys_per_bucket\":%d,\"avalanche_trials\":%d},",
+         cfg->hashes, cfg->bucket_bits, KEYS_PER_BUCKET, AVALANCHE_TRIALS);
+  printf("\"results\":[");
+  for (f = 0; f < HASH_COUNT; f++) {
+    printf("%s{\"hash\":\"%s\",\"keys_chi2_df\":%.4f,\"lengths\":[",
+           f ? "," : "", hash_funcs[f].name, keys[f]);
+    for (l = 0; l < LEN_COUNT; l++) {
+      const hash_result *r = &res[f][l];
+      printf("%s{\"len\":%zu,\"mhash_s\":%.2f,\"gb_s\":%.3f,"
+             "\"latency_ns\":%.2f,\"chi2_df\":%.4f,\"avalanche_mean\":%.4f,"
+             "\"avalanche_worst\":%.4f}",
+             l ? "," : "", key_lens[l], r->mhash_s, r->gb_s, r->latency_ns,
+             r->chi2_df, r->aval_mean, r->aval_worst);
+    }
+    printf("]}");
+  }
+  printf("]}\n");
+}
+
+// One row per hash and key length; run-wide columns repeat.
+static void print_csv(const hash_config *cfg, hash_result res[][LEN_COUNT],
+                      const double *keys) {
+  host_info h;
+  size_t f, l;
+
+  host_info_get(&h);
+  printf("schema,benchmark,");
+  csv_host_header();
+  printf(",hashes,bucket_bits,keys_per_bucket,avalanche_trials,hash,len,"
+         "mhash_s,gb_s,latency_ns,chi2_df,avalanche_mean,avalanche_worst,"
+         "keys_chi2_df\n");
+  for (f = 0; f < HASH_COUNT; f++) {
+    for (l = 0; l < LEN_COUNT; l++) {
+      const hash_result *r = &res[f][l];
+      printf("%d,hash,", RESULT_SCHEMA);
+      csv_host(&h);
+      printf(",%ld,%u,%d,%d,%s,%zu,%.2f,%.3f,%.2f,%.4f,%.4f,%.4f,%.4f\n",
+             cfg->hashes, cfg->bucket_bits, KEYS_PER_BUCKET,
+             AVALANCHE_TRIALS, hash_funcs[f].name, key_lens[l], r->mhash_s,
+             r->gb_s, r->latency_ns, r->chi2_df, r->aval_mean, r->aval_worst,
+             keys[f]);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  hash_config cfg = {.hashes = HASHES_DEFAULT,
+                     .bucket_bits = BUCKET_BITS_DEFAULT};
+  static hash_result res[HASH_COUNT][LEN_COUNT];
+  double keys[HASH_COUNT];
+  output_format format = FORMAT_TEXT;
+  unsigned char *pool;
+  uint32_t *counts, *flips;
+  unsigned rng = 0x6a09e667U;
+  size_t f, l;
+  int opt;
+
+  static const struct option long_opts[] = {
+      {"hashes", required_argument, NULL, 'n'},
+      {"bucket-bits", required_argument, NULL, 'b'},
+      {"format", required_argument, NULL, 'f'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  while ((opt = getopt_long(argc, argv, "n:b:f:h", long_opts, NULL)) != -1) {
+    switch (opt) {
+    case 'n':
+      cfg.hashes = atol(optarg);
+      break;
+    case 'b':
+      cfg.bucket_bits = (unsigned)atoi(optarg);
+      break;
+    case 'f':
+      if (format_parse(&format, optarg) < 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind != argc || cfg.hashes <= 0 || cfg.bucket_bits < 1 ||
+      cfg.bucket_bits > 24) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  pool = (unsigned char *)malloc((size_t)KEY_POOL * KEY_LEN_MAX);
+  counts = (uint32_t *)malloc(((size_t)1 << cfg.bucket_bits) *
+                              sizeof(*counts));
+  flips = (uint32_t *)malloc((size_t)KEY_LEN_MAX * 8 * cfg.bucket_bits *
+                             sizeof(*flips));
+  if (!pool || !counts || !flips) {
+    fprintf(stderr, "failed to allocate buffers\n");
+    return 1;
+  }
+  random_bytes(pool, (size_t)KEY_POOL * KEY_LEN_MAX, &rng);
+
+  if (format == FORMAT_TEXT) {
+    printf("Hash microbenchmark\n");
+    printf("Speed: %ld hashes per point; distribution: %u buckets, "
+           "%d keys each\n",
+           cfg.hashes, 1U << cfg.bucket_bits, KEYS_PER_BUCKET);
+    printf("chi2/df is 1 for a uniform spread; avalanche is the chance a "
+           "masked\noutput bit flips with one input bit (ideal 0.5, worst "
+           "bias 0)\n\n");
+    printf("%-11s %4s %9s %7s %7s %8s %9s %8s\n", "hash", "len", "Mhash/s",
+           "GB/s", "lat ns", "chi2/df", "aval", "worst");
+  }
+
+  for (f = 0; f < HASH_COUNT; f++) {
+    const hash_func *h = &hash_funcs[f];
+    for (l = 0; l < LEN_COUNT; l++) {
+      hash_result *r = &res[f][l];
+      measure_speed(h, key_lens[l], cfg.hashes, pool, r);
+      r->chi2_df = chi2_random(h, key_lens[l], cfg.bucket_bits, counts);
+      avalanche(h, key_lens[l], cfg.bucket_bits, flips, r);
+      if (format == FORMAT_TEXT) {
+        printf("%-11s %4zu %9.1f %7.2f %7.2f %8.3f %9.4f %8.4f\n", h->name,
+               key_lens[l], r->mhash_s, r->gb_s, r->latency_ns, r->chi2_df,
+               r->aval_mean, r->aval_worst);
+        fflush(stdout);
+      }
+    }
+    keys[f] = chi2_keys(h, cfg.bucket_bits, counts);
+  }
+
+  if (format == FORMAT_JSON) {
+    print_json(&cfg, res, keys);
+  } else if (format == FORMAT_CSV) {
+    print_csv(&cfg, res, keys);
+  } else {
+    printf("\nBenchmark keys (\"k<n>\"), chi2/df:\n");
+    for (f = 0; f < HASH_COUNT; f++) {
+      printf("  %-11s %8.3f\n", hash_funcs[f].name, keys[f]);
+    }
+  }
+
+  free(pool);
+  free(counts);
+  free(flips);
+  return 0;
+}
@@ -1,20 +1,30 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include "hash.h"
+#include "mem.h"
+
 #define BUFF_SIZE 1024
 #define TABLE_SIZE 1024
-
-#define FNV_OFFSET 14695981039346656037UL
-#define FNV_PRIME 1099511628211UL
+#define MAX_EVENTS 64
+#define HDR_MAX 16           // "<len>:" of a request frame, at most
+#define MSG_MAX (64UL << 20) // largest request payload
+#define OUT_MAX (1 << 20)    // queued reply bytes before reading pauses
+#define ACCEPT_RETRY_MS 100  // out of descriptors: try accept() again
 
 #ifdef DEBUG
 #define DEBUG_PRINT(fmt, ...)                                                  \
@@ -35,15 +45,6 @@ typedef struct {
   kv_entry entries[TABLE_SIZE];
 } hashmap;
 
-uint64_t fnv_hash(const char *x) {
-  uint64_t hash = FNV_OFFSET;
-  for (const char *p = x; *p; p++) {
-    hash ^= (uint64_t)(unsigned char)(*p);
-    hash *= FNV_PRIME;
-  }
-  return hash;
-}
-
 hashmap *hashmap_create() {
   hashmap *hm = (hashmap *)malloc(sizeof(hashmap));
   if (hm == NULL) {
@@ -55,7 +56,7 @@ hashmap *hashmap_create() {
 
 void hashmap_destroy(hashmap *hm) {
   for (size_t i = 0; i < TABLE_SIZE; i++) {
-    if (hm->entries[i].used) {
+    if (hm->entries[i].used && !hm->entries[i].deleted) {
       free(hm->entries[i].key);
       free(hm->entries[i].val);
     }
@@ -66,16 +67,24 @@ void hashmap_destroy(hashmap *hm) {
 void hashmap_set(hashmap *hm, const char *key, const char *val) {
   uint64_t hash = fnv_hash(key);
   size_t idx = hash & (TABLE_SIZE - 1);
+  kv_entry *slot = NULL;
 
   for (size_t i = 0; i < TABLE_SIZE; i++) {
     size_t probe = (idx + i) & (TABLE_SIZE - 1);
 
-    if (!hm->entries[probe].used || hm->entries[probe].deleted) {
-      hm->entries[probe].key = strdup(key);
-      hm->entries[probe].val = strdup(val);
-      hm->entries[probe].used = 1;
-      hm->entries[probe].deleted = 0;
-      return;
+    if (!hm->entries[probe].used) {
+      if (!slot)
+        slot = &hm->entries[probe];
+      break;
+    }
+
+    // Reuse the first tombstone, but only once we know the key isn't live
+    // further along the chain; otherwise a later delete would uncover the
+    // old copy.
+    if (hm->entries[probe].deleted) {
+      if (!slot)
+        slot = &hm->entries[probe];
+      continue;
     }
 
     // If we found the same key, update its value
@@ -85,6 +94,13 @@ void hashmap_set(hashmap *hm, const char *key, const char *val) {
       return;
     }
   }
+
+  if (slot) {
+    slot->key = strdup(key);
+    slot->val = strdup(val);
+    slot->used = 1;
+    slot->deleted = 0;
+  }
 }
 
 char *hashmap_get(hashmap *hm, const char *key) {
@@ -121,6 +137,10 @@ void hashmap_delete(hashmap *hm, const char *key) {
       return;
     }
 
+    if (hm->entries[probe].deleted) {
+      continue;
+    }
+
     if (strcmp(hm->entries[probe].key, key) == 0) {
       free(hm->entries[probe].key);
       free(hm->entries[probe].val);
@@ -130,92 +150,351 @@ void hashmap_delete(hashmap *hm, const char *key) {
   }
 }
 
-void handle_pkt(int fd, hashmap *hm) {
+// Memory accounting, logged at exit and returned for a "stats" request.
+static size_t rss_start; // before the table was created
 
-  char buf[BUFF_SIZE];
-  char *msg, *cmd, *key, *val, *reply;
-  size_t off = 0;
-  size_t len;
+void hashmap_mem(hashmap *hm, mem_report *m) {
+  memset(m, 0, sizeof(*m));
+  m->table_bytes = sizeof(*hm);
+  m->alloc_bytes = mem_alloc_bytes(hm);
+  for (size_t i = 0; i < TABLE_SIZE; i++) {
+    kv_entry *e = &hm->entries[i];
+    if (e->used && !e->deleted) {
+      m->keys++;
+      m->item_bytes += strlen(e->key) + strlen(e->val) + 2;
+      m->alloc_bytes += mem_alloc_bytes(e->key) + mem_alloc_bytes(e->val);
+    }
+  }
+  m->rss_before = rss_start;
+  m->rss_after = mem_rss_bytes();
+}
 
-  // Extract length
-  while (off < 8) {
-    ssize_t r = read(fd, buf + off, 1);
-    if (r == 0)
-      return; // No date
-    if (r < 0) {
+static void format_mem(hashmap *hm, char *buf, size_t cap) {
+  mem_report m;
+  hashmap_mem(hm, &m);
+  mem_format(&m, buf, cap);
+}
+
+// Traffic capture. A trace file is a 16-byte header ("BCTRACE" NUL, then
+// little-endian u32 version and u32 reserved) followed by one record per
+// little-endian request:
+//
+//   u64 ts_ns       time since capture start
+//   u32 value_size  bytes in the value (set only)
+//   u8  op          TRACE_GET, TRACE_SET or TRACE_DEL
+//   u8  key_len
+//   key_len bytes   the key
+//
+// benchcached_client --replay reads the same format.
+#define TRACE_MAGIC "BCTRACE"
+#define TRACE_VERSION 1
+#define TRACE_GET 0
+#define TRACE_SET 1
+#define TRACE_DEL 2
+
+#define TRACE_REC_FIXED 14 // record bytes before the key
+
+static FILE *trace_fp = NULL;
+static uint64_t trace_start_ns;
+static int trace_failed; // a write failed; the trace is truncated
+
+static void put_le(unsigned char *p, uint64_t v, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    p[i] = (unsigned char)(v >> (8 * i));
+  }
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int trace_open(const char *path) {
+  unsigned char hdr[16] = TRACE_MAGIC;
+
+  trace_fp = fopen(path, "wb");
+  if (trace_fp == NULL) {
+    return -1;
+  }
+  // Requests arrive far faster than the disk wants small writes.
+  setvbuf(trace_fp, NULL, _IOFBF, 1 << 20);
+  put_le(hdr + 8, TRACE_VERSION, 4);
+  if (fwrite(hdr, sizeof(hdr), 1, trace_fp) != 1) {
+    return -1;
+  }
+  trace_start_ns = now_ns();
+  return 0;
+}
+
+void trace_record(uint8_t op, const char *key, size_t value_size) {
+  size_t key_len = strlen(key);
+  unsigned char rec[TRACE_REC_FIXED + 255];
+
+  if (trace_fp == NULL || trace_failed || key_len > 255) {
+    return;
+  }
+  put_le(rec, now_ns() - trace_start_ns, 8);
+  put_le(rec + 8, (uint32_t)value_size, 4);
+  rec[12] = op;
+  rec[13] = (unsigned char)key_len;
+  memcpy(rec + TRACE_REC_FIXED, key, key_len);
+  if (fwrite(rec, TRACE_REC_FIXED + key_len, 1, trace_fp) != 1) {
+    trace_failed = 1;
+  }
+}
+
+// Reports a trace cut short by a failed write, such as a full disk.
+void trace_close(void) {
+  if (trace_fp != NULL) {
+    if (fclose(trace_fp) != 0) {
+      trace_failed = 1;
+    }
+    trace_fp = NULL;
+    if (trace_failed) {
+      fprintf(stderr, "trace: write failed, the trace is truncated\n");
+    }
+  }
+}
+
+// A client connection. Sockets are non-blocking: whatever has arrived is
+// read into in, only complete "<len>:<payload>" frames are served, and
+// replies queue in out until the socket takes them, so one slow or stalled
+// client never holds up the others.
+typedef struct {
+  int fd;
+  char *in;
+  size_t in_len;
+  size_t in_cap;
+  char *out;
+  size_t out_off; // bytes of out already written
+  size_t out_len;
+  size_t out_cap;
+  uint32_t events; // what epoll waits for
+} conn;
+
+static int grow(char **buf, size_t *cap, size_t need) {
+  size_t n = *cap ? *cap : BUFF_SIZE;
+  char *p;
+
+  while (n < need) {
+    n *= 2;
+  }
+  if (n == *cap) {
+    return 0;
+  }
+  p = realloc(*buf, n);
+  if (p == NULL) {
+    return -1;
+  }
+  *buf = p;
+  *cap = n;
+  return 0;
+}
+
+// Queues a framed reply "<len>:<payload>". Every request gets one, so a
+// client on a persistent connection can tell a miss apart from a slow server.
+static int conn_reply(conn *c, const char *payload, size_t len) {
+  char hdr[32];
+  int n = snprintf(hdr, sizeof(hdr), "%zu:", len);
+
+  if (grow(&c->out, &c->out_cap, c->out_len + (size_t)n + len) < 0) {
+    return -1;
+  }
+  memcpy(c->out + c->out_len, hdr, (size_t)n);
+  memcpy(c->out + c->out_len + n, payload, len);
+  c->out_len += (size_t)n + len;
+  return 0;
+}
+
+// Writes as much of the queued replies as the socket takes. Returns -1 if
+// the connection broke.
+static int conn_flush(conn *c) {
+  while (c->out_off < c->out_len) {
+    ssize_t w = write(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+    if (w < 0) {
       if (errno == EINTR)
         continue;
-      else {
-        perror("read() failed");
-        exit(1);
-      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      DEBUG_PRINT("write() failed: %s", strerror(errno));
+      return -1;
     }
-    if (buf[off] == ':')
-      break;
-    off += r;
+    c->out_off += (size_t)w;
   }
-  buf[off] = '\0';
-  len = atol(buf);
-  DEBUG_PRINT("Message length: %zu", len);
-
-  msg = malloc((len + 1) * sizeof(char));
-  off = 0;
+  c->out_off = 0;
+  c->out_len = 0;
+  return 0;
+}
 
-  while (off < len) {
-    ssize_t r = read(fd, msg + off, len - off);
+// Reads everything the socket holds. Returns 1 once the peer has closed,
+// -1 on error and 0 otherwise.
+static int conn_fill(conn *c) {
+  for (;;) {
+    ssize_t r;
+    if (grow(&c->in, &c->in_cap, c->in_len + BUFF_SIZE) < 0) {
+      return -1;
+    }
+    r = read(c->fd, c->in + c->in_len, c->in_cap - c->in_len - 1);
     if (r == 0)
-      break;
+      return 1;
     if (r < 0) {
       if (errno == EINTR)
         continue;
-      else {
-        perror("read() failed");
-        exit(1);
-      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      DEBUG_PRINT("read() failed: %s", strerror(errno));
+      return -1;
     }
-    off += r;
+    c->in_len += (size_t)r;
   }
-  msg[off] = '\0';
+}
+
+// Serves one request: get:KEY, set:KEY:VAL, del:KEY, or stats for the
+// memory report. msg is NUL-terminated and may be modified.
+static int handle_pkt(conn *c, hashmap *hm, char *msg) {
+  char stats[256];
+  char *cmd, *key, *val, *reply;
 
   DEBUG_PRINT("Message received: %s", msg);
 
   cmd = strtok(msg, ":");
   reply = NULL;
-  if (strcmp(cmd, "get") == 0) {
+  if (cmd == NULL) {
+    // Empty request; answer with an empty reply below.
+  } else if (strcmp(cmd, "get") == 0) {
     if ((key = strtok(NULL, ":"))) {
       reply = hashmap_get(hm, key);
+      trace_record(TRACE_GET, key, 0);
       DEBUG_PRINT("Get: %s", key);
     }
   } else if (strcmp(cmd, "set") == 0) {
     if ((key = strtok(NULL, ":")) && (val = strtok(NULL, ":"))) {
       hashmap_set(hm, key, val);
+      trace_record(TRACE_SET, key, strlen(val));
       DEBUG_PRINT("Set: %s -> %s", key, val);
     }
   } else if (strcmp(cmd, "del") == 0) {
     if ((key = strtok(NULL, ":"))) {
       hashmap_delete(hm, key);
+      trace_record(TRACE_DEL, key, 0);
       DEBUG_PRINT("Del: %s", key);
     }
+  } else if (strcmp(cmd, "stats") == 0) {
+    format_mem(hm, stats, sizeof(stats));
+    reply = stats;
   }
+  DEBUG_PRINT("Reply: %s", reply ? reply : "");
+
+  return conn_reply(c, reply ? reply : "", reply ? strlen(reply) : 0);
+}
+
+// Serves every complete frame in c->in, keeping a partial one for the next
+// read. Stops early while OUT_MAX bytes of replies are waiting, so a client
+// that pipelines without reading can't grow out without bound. Returns -1
+// if the stream is broken.
+static int conn_serve(conn *c, hashmap *hm) {
+  size_t off = 0;
 
-  if (reply) {
-    write(fd, reply, strlen(reply));
-    DEBUG_PRINT("Reply: %s", reply);
+  while (off < c->in_len && c->out_len < OUT_MAX) {
+    char *hdr = c->in + off;
+    size_t avail = c->in_len - off;
+    char *colon = memchr(hdr, ':', avail < HDR_MAX ? avail : HDR_MAX);
+    char *end;
+    unsigned long len;
+
+    if (colon == NULL) {
+      if (avail >= HDR_MAX) {
+        return -1;
+      }
+      break;
+    }
+    len = strtoul(hdr, &end, 10);
+    if (end != colon || colon == hdr || len > MSG_MAX) {
+      return -1;
+    }
+    if ((size_t)(colon + 1 - c->in) + len > c->in_len) {
+      // Make room for the rest of the frame (and its NUL) up front.
+      if (grow(&c->in, &c->in_cap, (size_t)(colon + 1 - hdr) + len + 1) < 0) {
+        return -1;
+      }
+      break;
+    }
+    {
+      char *msg = colon + 1;
+      char saved = msg[len];
+      msg[len] = '\0';
+      if (handle_pkt(c, hm, msg) < 0) {
+        return -1;
+      }
+      msg[len] = saved;
+      off = (size_t)(msg + len - c->in);
+    }
   }
+  memmove(c->in, c->in + off, c->in_len - off);
+  c->in_len -= off;
+  return 0;
+}
 
-  free(msg);
+static void conn_close(int epfd, conn *c) {
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  free(c->in);
+  free(c->out);
+  free(c);
+  DEBUG_PRINT("connection closed");
+}
+
+// Reads, serves and writes what it can for one readiness event, then waits
+// for input again, or only for the socket to drain while replies are queued.
+// Returns -1 once the connection should be closed.
+static int conn_event(int epfd, conn *c, hashmap *hm, uint32_t events) {
+  struct epoll_event ev;
+  int closed = 0;
+
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    closed = conn_fill(c);
+    if (closed < 0) {
+      return -1;
+    }
+  }
+  for (;;) {
+    size_t before = c->in_len;
+    if (conn_serve(c, hm) < 0 || conn_flush(c) < 0) {
+      return -1;
+    }
+    if (c->out_len || c->in_len == before) {
+      break;
+    }
+  }
+  if (closed) {
+    return -1;
+  }
+  ev.events = c->out_len ? EPOLLOUT : EPOLLIN;
+  ev.data.ptr = c;
+  if (ev.events != c->events &&
+      epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+    return -1;
+  }
+  c->events = ev.events;
+  return 0;
 }
 
 static volatile sig_atomic_t done = 0;
 
-static void handle_sig(int sig) { done = 1; }
+static void handle_sig(int sig) {
+  (void)sig;
+  done = 1;
+}
 
 void usage(const char *prog) {
   fprintf(stderr,
-          "%s <port> <timeout>\n"
+          "%s <port> <timeout> [trace]\n"
           "\n"
           "  port     TCP port number\n"
-          "  timeout  Time in seconds (non-positive = run forever)\n",
+          "  timeout  Time in seconds (non-positive = run forever)\n"
+          "  trace    Record every request into this file for replay with\n"
+          "           benchcached_client --replay\n",
           prog);
 }
 
@@ -223,13 +502,18 @@ int main(int argc, char *argv[]) {
 
   unsigned port;
   int timeout;
-  int sockfd, connfd = -1;
+  int sockfd, epfd;
   socklen_t len;
+  struct epoll_event ev, events[MAX_EVENTS];
   struct sockaddr_in servaddr, cli;
+  char stats[256];
+  int accept_paused = 0; // listener removed from the poll set
+  int closed_any = 0;    // a connection closed since the last wakeup
 
+  rss_start = mem_rss_bytes();
   hashmap *hm = hashmap_create();
 
-  if (argc != 3) {
+  if (argc != 3 && argc != 4) {
     usage(argv[0]);
     exit(1);
   }
@@ -237,6 +521,11 @@ int main(int argc, char *argv[]) {
   port = atoi(argv[1]);
   timeout = atoi(argv[2]);
 
+  if (argc == 4 && trace_open(argv[3]) < 0) {
+    perror("trace_open() failed");
+    exit(1);
+  }
+
   DEBUG_PRINT("port: %d", port);
   DEBUG_PRINT("timeout: %d", timeout);
 
@@ -247,12 +536,28 @@ int main(int argc, char *argv[]) {
 
   signal(SIGTERM, handle_sig);
 
-  if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+  // Allow as many client connections as the hard limit permits.
+  {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+      rl.rlim_cur = rl.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &rl);
+    }
+  }
+  // A client hanging up mid-reply must not take the server down.
+  signal(SIGPIPE, SIG_IGN);
+
+  if ((sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
     perror("socket() failed");
     exit(1);
   }
   DEBUG_PRINT("socket() succeeded");
 
+  {
+    int one = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  }
+
   bzero(&servaddr, sizeof(servaddr));
 
   servaddr.sin_family = AF_INET;
@@ -265,33 +570,109 @@ int main(int argc, char *argv[]) {
   }
   DEBUG_PRINT("bind() succeeded");
 
-  if ((listen(sockfd, 5)) < 0) {
+  if ((listen(sockfd, SOMAXCONN)) < 0) {
     perror("listen() failed");
     exit(1);
   }
   DEBUG_PRINT("listen() succeeded");
-  len = sizeof(cli);
 
+  if ((epfd = epoll_create1(0)) < 0) {
+    perror("epoll_create1() failed");
+    exit(1);
+  }
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL; // the listener; connections carry their conn
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0) {
+    perror("epoll_ctl() failed");
+    exit(1);
+  }
+
+  // Connections stay open until the client hangs up, so a client can either
+  // reconnect per request or keep a persistent connection.
   while (!done) {
-    connfd = accept(sockfd, (struct sockaddr *)&cli, &len);
-    if (connfd < 0) {
+    int n = epoll_wait(epfd, events, MAX_EVENTS,
+                       accept_paused ? ACCEPT_RETRY_MS : -1);
+    if (n < 0) {
       if (errno == EINTR) {
         continue;
       }
-      perror("accept() failed");
+      perror("epoll_wait() failed");
       exit(1);
     }
-    DEBUG_PRINT("accept() succeeded");
-    handle_pkt(connfd, hm);
-    close(connfd);
-    connfd = -1;
-  }
 
-  if (connfd >= 0) {
-    close(connfd);
+    // Out of descriptors, the listener stops polling: it is level-triggered
+    // and would wake the loop for the same backlog forever. Pending clients
+    // wait in the backlog until a connection closes or the retry timer runs.
+    if (accept_paused && (n == 0 || closed_any)) {
+      ev.events = EPOLLIN;
+      ev.data.ptr = NULL;
+      epoll_ctl(epfd, EPOLL_CTL_MOD, sockfd, &ev);
+      accept_paused = 0;
+    }
+    closed_any = 0;
+
+    for (int i = 0; i < n; i++) {
+      conn *c = events[i].data.ptr;
+
+      if (c == NULL) {
+        // Drain the backlog; a burst of clients arrives in one wakeup.
+        while (!accept_paused) {
+          int one = 1;
+          int connfd;
+
+          len = sizeof(cli);
+          connfd = accept4(sockfd, (struct sockaddr *)&cli, &len,
+                           SOCK_NONBLOCK);
+          if (connfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+              continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+              break;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+              DEBUG_PRINT("accept() failed: %s", strerror(errno));
+              ev.events = 0;
+              ev.data.ptr = NULL;
+              epoll_ctl(epfd, EPOLL_CTL_MOD, sockfd, &ev);
+              accept_paused = 1;
+              break;
+            }
+            perror("accept() failed");
+            exit(1);
+          }
+          DEBUG_PRINT("accept() succeeded");
+          setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+          c = calloc(1, sizeof(*c));
+          if (c == NULL) {
+            close(connfd);
+            continue;
+          }
+          c->fd = connfd;
+          c->events = EPOLLIN;
+          ev.events = EPOLLIN;
+          ev.data.ptr = c;
+          if (epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+            close(connfd);
+            free(c);
+          }
+        }
+        continue;
+      }
+
+      if (conn_event(epfd, c, hm, events[i].events) < 0) {
+        conn_close(epfd, c);
+        closed_any = 1;
+      }
+    }
   }
+
+  close(epfd);
   close(sockfd);
 
+  trace_close();
+  format_mem(hm, stats, sizeof(stats));
+  fprintf(stderr, "memory: %s\n", stats);
   hashmap_destroy(hm);
 
   return 0;
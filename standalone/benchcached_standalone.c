@@ -1,41 +1,97 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-
-#define KEY_MAX 64
-#define VAL_MAX 128
-
-typedef struct {
-  char *key;
-  char *val;
-  int used;
-  int deleted;
-} kv_entry;
-
-typedef struct {
-  kv_entry *entries;
-  size_t cap;
-} hashmap;
-
-typedef struct {
-  uint64_t count;
-  uint64_t total_ns;
-} metric;
+#include <unistd.h>
+
+#include "engine.h"
+#include "hist.h"
+#include "mem.h"
+#include "perf.h"
+#include "report.h"
+#include "workload.h"
+
+#define KEY_SLOT 16 // one "k<n>" key of the key table
+#define BATCH_DEFAULT 1024 // requests drawn per timed batch
+#define BATCH_ARENA_MAX (64U << 20) // ends a batch early for large values
+#define TIMER_CALIBRATE_ROUNDS 100000
+#define THREADS_MAX 256
+#define SCALE_P99 2 // index of p99 in report_q
 
 static void usage(const char *prog) {
+  size_t i;
   fprintf(stderr,
-          "%s <requests> <keyspace>\n"
+          "%s [options] <requests> <keyspace>\n"
           "\n"
-          "Workload mix:\n"
-          "  get: 70%%\n"
-          "  set: 20%%\n"
-          "  del: 10%%\n"
+          "Options:\n"
+          "  -k, --keys SPEC      key distribution, see below\n"
+          "  -m, --mix SPEC       operation mix, see below\n"
+          "  -v, --values SPEC    value size distribution, see below\n"
+          "  -e, --engine NAME    map backend, see below\n"
+          "  -f, --format FMT     results as text (default), json or csv\n"
+          "  -b, --batch N        draw N requests at a time outside the "
+          "clock\n"
+          "                       (default 1024)\n"
+          "      --pregen         draw the whole run before timing it\n"
+          "  -s, --sample F       record the latency of a fraction F of "
+          "requests\n"
+          "                       (default 0.01); the rest run without clock "
+          "readings.\n"
+          "                       Throughput counts every request, sampled "
+          "or not,\n"
+          "                       so a large F mostly measures the clock\n"
+          "  -t, --threads N      scaling run: 1, 2, 4, ... N pinned threads "
+          "share\n"
+          "                       one map, each drawing its part of the "
+          "requests\n"
+          "                       up front\n"
+          "      --shards N       lock stripes guarding the shared map "
+          "(default 1)\n"
+          "      --perf           count cycles, instructions and LLC, dTLB "
+          "and\n"
+          "                       branch misses per op (user space)\n"
+          "\n"
+          "Engines (-e/--engine):\n",
+          prog);
+  for (i = 0; engines[i]; i++) {
+    fprintf(stderr, "  %-19s %s\n", engines[i]->name, engines[i]->desc);
+  }
+  fprintf(stderr,
+          "\n"
+          "Key distributions (-k/--keys):\n"
+          "  uniform             every key equally likely (default)\n"
+          "  zipfian[:T]         skewed towards key 0, theta T (0.99)\n"
+          "  scrambled[:T]       zipfian with hot keys spread over the "
+          "keyspace\n"
+          "  hotspot[:F:P]       P of requests on a fraction F of keys "
+          "(0.2:0.8)\n"
+          "  latest[:T]          sets insert new keys, reads favour recent "
+          "ones\n"
+          "\n"
+          "Value sizes (-v/--values):\n"
+          "  default             short \"v<n>\" values\n"
+          "  fixed:N             N bytes\n"
+          "  uniform:MIN:MAX     uniform between MIN and MAX bytes\n"
+          "  normal:MEAN:SD      normal, clamped to 1..4 MiB\n"
+          "  file:PATH           \"<size> [weight]\" lines from PATH\n"
+          "\n"
+          "Workload mix (-m/--mix):\n"
+          "  default             get 70%%, set 20%%, del 10%%\n"
+          "  ycsb-a .. ycsb-f    YCSB core workloads; also select zipfian\n"
+          "                      (latest for ycsb-d) keys unless -k is given\n"
+          "  get:N,set:N,...     custom percentages of get, set, del, scan\n"
+          "                      and rmw, adding up to 100\n"
           "\n"
           "Example:\n"
           "  %s 500000 1024\n",
-          prog, prog);
+          prog);
 }
 
 static uint64_t now_ns(void) {
@@ -44,270 +100,847 @@ static uint64_t now_ns(void) {
   return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
 }
 
-static uint64_t fnv_hash(const char *s) {
-  uint64_t hash = 14695981039346656037ULL;
-  while (*s) {
-    hash ^= (uint64_t)(unsigned char)(*s++);
-    hash *= 1099511628211ULL;
-  }
-  return hash;
-}
+// A request and the arena offset of its value.
+typedef struct {
+  request r;
+  size_t val;
+} batch_op;
 
-static size_t next_pow2(size_t x) {
-  size_t p = 1;
-  while (p < x) {
-    p <<= 1;
+// Requests drawn ahead of the timed loop: a batch at a time, or the whole
+// run with --pregen. Set and rmw values sit back to back in arena.
+typedef struct {
+  batch_op *ops;
+  long cap;
+  long n;
+  char *arena;
+  size_t len;
+  size_t arena_cap;
+} batch;
+
+typedef struct {
+  double seconds; // time spent in the timed batches
+  double throughput;
+  uint64_t timer_ns; // calibrated clock overhead, taken off every sample
+  uint64_t failures;
+  uint64_t hits; // gets, scan steps and rmw reads that found their key
+  perf_counts perf; // --perf: counted over the timed batches
+  mem_report mem;   // the map once loaded, before the timed run
+} run_result;
+
+// Applies r to the map. key is r's key; scans read the keys after it from
+// keytab. Counting hits also keeps the compiler from dropping lookups whose
+// result would otherwise go unused.
+static void run_request(const engine *e, void *map, const request *r,
+                        const char *key, const char *val, const char *keytab,
+                        uint32_t keyspace, run_result *res) {
+  uint32_t k;
+
+  switch (r->op) {
+  case OP_GET:
+    res->hits += e->get(map, key) != NULL;
+    break;
+  case OP_SET:
+    if (e->set(map, key, val) < 0) {
+      res->failures++;
+    }
+    break;
+  case OP_DEL:
+    e->del(map, key);
+    break;
+  case OP_SCAN:
+    for (k = 0; k < r->steps; k++) {
+      size_t id = (r->key_id + k) % keyspace;
+      res->hits += e->get(map, keytab + id * KEY_SLOT) != NULL;
+    }
+    break;
+  default:
+    res->hits += e->get(map, key) != NULL;
+    if (e->set(map, key, val) < 0) {
+      res->failures++;
+    }
+    break;
   }
-  return p;
 }
 
-static hashmap *hashmap_create(size_t expected_items) {
-  hashmap *hm;
-  size_t cap = next_pow2(expected_items * 2 + 1);
+// Runs every request of b, recording the latency of those picked by
+// sample_rng, less the calibrated clock overhead in res->timer_ns.
+static void run_batch(const engine *e, void *map, const batch *b,
+                      const char *keytab, uint32_t keyspace,
+                      uint32_t sample_below, unsigned *sample_rng, metric *m,
+                      run_result *res) {
+  long i;
 
-  hm = (hashmap *)malloc(sizeof(*hm));
-  if (!hm) {
-    return NULL;
+  for (i = 0; i < b->n; i++) {
+    const batch_op *p = &b->ops[i];
+    const char *key = keytab + (size_t)p->r.key_id * KEY_SLOT;
+    uint64_t s0, s1;
+
+    if ((lcg_next(sample_rng) >> 8) >= sample_below) {
+      run_request(e, map, &p->r, key, b->arena + p->val, keytab, keyspace,
+                  res);
+      continue;
+    }
+    s0 = now_ns();
+    run_request(e, map, &p->r, key, b->arena + p->val, keytab, keyspace, res);
+    s1 = now_ns();
+    record(&m[p->r.op],
+           s1 - s0 > res->timer_ns ? s1 - s0 - res->timer_ns : 0);
   }
+}
 
-  hm->entries = (kv_entry *)calloc(cap, sizeof(kv_entry));
-  if (!hm->entries) {
-    free(hm);
+// Every key of the keyspace, KEY_SLOT bytes apart.
+static char *key_table(uint32_t keyspace) {
+  char *tab = (char *)malloc((size_t)keyspace * KEY_SLOT);
+  uint32_t i;
+  if (!tab) {
     return NULL;
   }
-
-  hm->cap = cap;
-  return hm;
+  for (i = 0; i < keyspace; i++) {
+    snprintf(tab + (size_t)i * KEY_SLOT, KEY_SLOT, "k%u", i);
+  }
+  return tab;
 }
 
-static void hashmap_destroy(hashmap *hm) {
-  size_t i;
-  if (!hm) {
-    return;
+// Refills b with up to n requests, stopping early once their values take
+// arena_max bytes. Returns -1 if the buffers can't grow.
+static int batch_fill(batch *b, long n, size_t arena_max, const op_mix *mix,
+                      const key_dist *keys, const value_dist *values,
+                      unsigned *rng, uint64_t *latest) {
+  if (b->cap < n) {
+    batch_op *ops = (batch_op *)realloc(b->ops, (size_t)n * sizeof(*ops));
+    if (!ops) {
+      return -1;
+    }
+    b->ops = ops;
+    b->cap = n;
   }
-  for (i = 0; i < hm->cap; i++) {
-    if (hm->entries[i].used && !hm->entries[i].deleted) {
-      free(hm->entries[i].key);
-      free(hm->entries[i].val);
+  b->n = 0;
+  b->len = 0;
+  while (b->n < n && (b->n == 0 || b->len < arena_max)) {
+    batch_op *p = &b->ops[b->n++];
+
+    workload_next(&p->r, mix, keys, values, rng, latest);
+    p->val = b->len;
+    if (p->r.op != OP_SET && p->r.op != OP_RMW) {
+      continue;
+    }
+    // make_value() writes at least "v<seed>" and the NUL.
+    while (b->len + p->r.size + 16 > b->arena_cap) {
+      size_t cap = b->arena_cap ? b->arena_cap * 2 : 1 << 16;
+      char *arena = (char *)realloc(b->arena, cap);
+      if (!arena) {
+        return -1;
+      }
+      b->arena = arena;
+      b->arena_cap = cap;
     }
+    b->len += make_value(b->arena + b->len, p->r.seed, p->r.size) + 1;
   }
-  free(hm->entries);
-  free(hm);
+  return 0;
 }
 
-static int hashmap_set(hashmap *hm, const char *key, const char *val) {
-  size_t i;
-  size_t idx = (size_t)(fnv_hash(key) & (uint64_t)(hm->cap - 1));
-  ssize_t first_tomb = -1;
-
-  for (i = 0; i < hm->cap; i++) {
-    size_t probe = (idx + i) & (hm->cap - 1);
-    kv_entry *e = &hm->entries[probe];
+// Stores every key of the keyspace, with values drawn from the same stream
+// on every call, counting failed sets in res.
+static void warm_map(const engine *e, void *map, long keyspace,
+                     const value_dist *values, char *val, run_result *res) {
+  unsigned warm_rng = 0x2545f491U;
+  long i;
 
-    if (!e->used) {
-      kv_entry *dst;
-      if (first_tomb >= 0) {
-        dst = &hm->entries[(size_t)first_tomb];
-      } else {
-        dst = e;
-      }
-      dst->key = strdup(key);
-      dst->val = strdup(val);
-      if (!dst->key || !dst->val) {
-        free(dst->key);
-        free(dst->val);
-        dst->key = NULL;
-        dst->val = NULL;
-        dst->used = 0;
-        dst->deleted = 0;
-        return -1;
-      }
-      dst->used = 1;
-      dst->deleted = 0;
-      return 0;
+  for (i = 0; i < keyspace; i++) {
+    char key[KEY_MAX];
+    snprintf(key, sizeof(key), "k%ld", i);
+    make_value(val, (uint32_t)i, value_dist_next(values, &warm_rng));
+    if (e->set(map, key, val) < 0) {
+      res->failures++;
     }
+  }
+}
 
-    if (e->deleted) {
-      if (first_tomb < 0) {
-        first_tomb = (ssize_t)probe;
-      }
-      continue;
+// Cost of one clock reading as a latency sample sees it: the smallest gap
+// between back-to-back readings.
+static uint64_t timer_overhead_ns(void) {
+  uint64_t best = UINT64_MAX;
+  int i;
+  for (i = 0; i < TIMER_CALIBRATE_ROUNDS; i++) {
+    uint64_t t0 = now_ns();
+    uint64_t t1 = now_ns();
+    if (t1 - t0 < best) {
+      best = t1 - t0;
     }
+  }
+  return best;
+}
 
-    if (strcmp(e->key, key) == 0) {
-      char *new_val = strdup(val);
-      if (!new_val) {
-        return -1;
-      }
-      free(e->val);
-      e->val = new_val;
-      return 0;
-    }
+typedef struct {
+  const engine *engine;
+  long requests;
+  long keyspace;
+  long batch;    // requests drawn per timed batch
+  double sample; // fraction of requests whose latency is recorded
+  int pregen;    // draw the whole run before timing
+  long threads;  // scale up to this many threads, 0 for a plain run
+  long shards;   // lock stripes of the map the threads share
+  int perf;      // count hardware events over the timed window
+} bench_config;
+
+// Everything up to the results: host, config and workload.
+static void json_head(const bench_config *cfg, const op_mix *mix,
+                      const key_dist *keys, const value_dist *values) {
+  host_info h;
+  host_info_get(&h);
+  printf("{\"schema\":%d,\"benchmark\":\"standalone\",", RESULT_SCHEMA);
+  json_host(&h);
+  printf(",\"config\":{\"engine\":\"%s\",\"requests\":%ld,\"keyspace\":%ld,"
+         "\"pregen\":%s",
+         cfg->engine->name, cfg->requests, cfg->keyspace,
+         cfg->pregen ? "true" : "false");
+  printf(",\"batch\":%ld,\"sample\":%g,\"threads\":%ld,\"shards\":%ld,"
+         "\"perf\":%s},",
+         cfg->batch, cfg->sample, cfg->threads, cfg->shards,
+         cfg->perf ? "true" : "false");
+  json_workload(mix, keys, values);
+}
+
+static void print_json(const bench_config *cfg, const op_mix *mix,
+                       const key_dist *keys, const value_dist *values,
+                       const metric *m, const run_result *res) {
+  json_head(cfg, mix, keys, values);
+  printf(",\"results\":{\"seconds\":%.6f,\"throughput\":%.1f,"
+         "\"timer_overhead_ns\":%llu,\"failures\":%llu,\"hits\":%llu,",
+         res->seconds, res->throughput, (unsigned long long)res->timer_ns,
+         (unsigned long long)res->failures, (unsigned long long)res->hits);
+  json_metrics(stdout, m);
+  printf(",");
+  if (cfg->perf) {
+    json_perf(&res->perf, (double)cfg->requests);
+  } else {
+    printf("\"perf\":null");
   }
+  printf(",");
+  json_mem(&res->mem);
+  printf("}}\n");
+}
 
-  return -1;
+// One row per operation; run-wide columns repeat so rows stand alone.
+static void print_csv(const bench_config *cfg, const op_mix *mix,
+                      const key_dist *keys, const value_dist *values,
+                      const metric *m, const run_result *res) {
+  host_info h;
+  unsigned op;
+  host_info_get(&h);
+  printf("schema,benchmark,");
+  csv_host_header();
+  printf(",engine,requests,keyspace,pregen,");
+  csv_workload_header();
+  printf(",failures,");
+  csv_metric_header(stdout);
+  printf(",batch,sample,seconds,throughput,timer_overhead_ns,hits,");
+  csv_perf_header();
+  printf(",");
+  csv_mem_header();
+  printf("\n");
+  for (op = 0; op < OP_COUNT; op++) {
+    printf("%d,standalone,", RESULT_SCHEMA);
+    csv_host(&h);
+    printf(",%s,%ld,%ld,%d,", cfg->engine->name, cfg->requests, cfg->keyspace,
+           cfg->pregen);
+    csv_workload(mix, keys, values);
+    printf(",%llu,", (unsigned long long)res->failures);
+    csv_metric(stdout, op, &m[op]);
+    printf(",%ld,%g,%.6f,%.1f,%llu,%llu,", cfg->batch, cfg->sample,
+           res->seconds, res->throughput, (unsigned long long)res->timer_ns,
+           (unsigned long long)res->hits);
+    csv_perf(&res->perf, (double)cfg->requests);
+    printf(",");
+    csv_mem(&res->mem);
+    printf("\n");
+  }
 }
 
-static const char *hashmap_get(const hashmap *hm, const char *key) {
-  size_t i;
-  size_t idx = (size_t)(fnv_hash(key) & (uint64_t)(hm->cap - 1));
+// What the threads of a scaling step share.
+typedef struct {
+  const bench_config *cfg;
+  const op_mix *mix;
+  const key_dist *keys;
+  const value_dist *values;
+  const char *keytab;
+  uint32_t sample_below;
+  uint64_t timer_ns;
+  void *map; // driven through engine_locked
+  pthread_barrier_t barrier;
+  pthread_mutex_t start_lock; // held while the step's threads are created
+  int aborted;                // one failed to start: the others give up
+} scale_shared;
+
+// One thread of a scaling step. It draws its part of the requests from its
+// own streams before the start barrier, so only map calls overlap.
+typedef struct {
+  pthread_t tid;
+  scale_shared *sh;
+  int cpu; // pinned to this CPU, or -1
+  long requests;
+  unsigned rng;
+  unsigned sample_rng;
+  uint64_t latest;
+  batch b;
+  int drawn; // batch_fill() succeeded
+  perf_set ps; // --perf: this thread's counters
+  uint64_t start_ns;
+  uint64_t end_ns;
+  run_result res;
+  metric m[OP_COUNT];
+} scale_thread;
 
-  for (i = 0; i < hm->cap; i++) {
-    size_t probe = (idx + i) & (hm->cap - 1);
-    const kv_entry *e = &hm->entries[probe];
+typedef struct {
+  long threads;
+  double seconds;
+  double throughput;
+  double speedup; // over the one-thread step
+  uint64_t failures;
+  uint64_t hits;
+  uint64_t count;
+  double avg_us;
+  double q_us[REPORT_Q_COUNT];
+  double max_us;
+  perf_counts perf;
+} scale_step;
+
+static void *run_scale_thread(void *arg) {
+  scale_thread *t = (scale_thread *)arg;
+  scale_shared *sh = t->sh;
+  int aborted;
+
+  // The barrier expects every thread of the step, so none may wait on it
+  // until all of them exist.
+  pthread_mutex_lock(&sh->start_lock);
+  aborted = sh->aborted;
+  pthread_mutex_unlock(&sh->start_lock);
+  if (aborted) {
+    return NULL;
+  }
 
-    if (!e->used) {
-      return NULL;
-    }
-    if (e->deleted) {
-      continue;
-    }
-    if (strcmp(e->key, key) == 0) {
-      return e->val;
-    }
+  if (t->cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(t->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
   }
+  t->drawn = batch_fill(&t->b, t->requests, SIZE_MAX, sh->mix, sh->keys,
+                        sh->values, &t->rng, &t->latest) == 0;
+  if (sh->cfg->perf) {
+    perf_open(&t->ps);
+  }
+  pthread_barrier_wait(&sh->barrier);
 
+  if (sh->cfg->perf) {
+    perf_enable(&t->ps);
+  }
+  t->start_ns = now_ns();
+  if (t->drawn) {
+    run_batch(&engine_locked, sh->map, &t->b, sh->keytab,
+              (uint32_t)sh->cfg->keyspace, sh->sample_below, &t->sample_rng,
+              t->m, &t->res);
+  }
+  t->end_ns = now_ns();
+  if (sh->cfg->perf) {
+    perf_disable(&t->ps);
+    perf_read(&t->ps, &t->res.perf);
+    perf_close(&t->ps);
+  }
   return NULL;
 }
 
-static void hashmap_delete(hashmap *hm, const char *key) {
-  size_t i;
-  size_t idx = (size_t)(fnv_hash(key) & (uint64_t)(hm->cap - 1));
+// Runs one step with n threads against a freshly warmed map. Thread 0 draws
+// the same streams as a plain run; the others get their own seeds.
+static int scale_run_step(scale_shared *sh, scale_thread *threads, long n,
+                          const int *cpus, int ncpus, char *val,
+                          scale_step *st) {
+  const bench_config *cfg = sh->cfg;
+  metric all = {0};
+  run_result warm = {0};
+  uint64_t start_ns = UINT64_MAX, end_ns = 0;
+  long i;
+  unsigned op, q;
 
-  for (i = 0; i < hm->cap; i++) {
-    size_t probe = (idx + i) & (hm->cap - 1);
-    kv_entry *e = &hm->entries[probe];
+  sh->map = locked_create(cfg->engine, (size_t)cfg->keyspace,
+                          (unsigned)cfg->shards);
+  if (!sh->map) {
+    fprintf(stderr, "failed to allocate the %s map\n", cfg->engine->name);
+    return -1;
+  }
+  warm_map(&engine_locked, sh->map, cfg->keyspace, sh->values, val, &warm);
+
+  pthread_barrier_init(&sh->barrier, NULL, (unsigned)n);
+  pthread_mutex_init(&sh->start_lock, NULL);
+  sh->aborted = 0;
+  pthread_mutex_lock(&sh->start_lock);
+  for (i = 0; i < n; i++) {
+    scale_thread *t = &threads[i];
+    batch b = t->b;
+
+    memset(t, 0, sizeof(*t));
+    t->b = b; // buffers are reused from step to step
+    t->sh = sh;
+    t->cpu = ncpus ? cpus[i % ncpus] : -1;
+    t->requests = cfg->requests / n + (i < cfg->requests % n);
+    t->rng = workload_seed((unsigned)i);
+    t->sample_rng = 0x6a09e667U + (unsigned)i * 0xc2b2ae35U;
+    t->latest = (uint64_t)cfg->keyspace;
+    t->res.timer_ns = sh->timer_ns;
+    if (pthread_create(&t->tid, NULL, run_scale_thread, t) != 0) {
+      fprintf(stderr, "failed to start benchmark thread\n");
+      sh->aborted = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&sh->start_lock);
+  n = i; // the threads actually started
+  for (i = 0; i < n; i++) {
+    pthread_join(threads[i].tid, NULL);
+  }
+  pthread_mutex_destroy(&sh->start_lock);
+  pthread_barrier_destroy(&sh->barrier);
+  engine_locked.destroy(sh->map);
+  if (sh->aborted) {
+    return -1;
+  }
 
-    if (!e->used) {
-      return;
+  memset(st, 0, sizeof(*st));
+  st->threads = n;
+  st->failures = warm.failures;
+  for (i = 0; i < n; i++) {
+    const scale_thread *t = &threads[i];
+    if (!t->drawn) {
+      fprintf(stderr, "failed to allocate the request batch\n");
+      return -1;
     }
-    if (e->deleted) {
-      continue;
+    start_ns = t->start_ns < start_ns ? t->start_ns : start_ns;
+    end_ns = t->end_ns > end_ns ? t->end_ns : end_ns;
+    st->failures += t->res.failures;
+    st->hits += t->res.hits;
+    perf_merge(&st->perf, &t->res.perf);
+    for (op = 0; op < OP_COUNT; op++) {
+      metric_merge(&all, &t->m[op]);
     }
-    if (strcmp(e->key, key) == 0) {
-      free(e->key);
-      free(e->val);
-      e->key = NULL;
-      e->val = NULL;
-      e->deleted = 1;
-      return;
+  }
+  st->seconds = (double)(end_ns - start_ns) / 1e9;
+  st->throughput = (double)cfg->requests / st->seconds;
+  st->count = all.count;
+  st->avg_us = metric_avg_us(&all);
+  for (q = 0; q < REPORT_Q_COUNT; q++) {
+    st->q_us[q] = (double)metric_percentile(&all, report_q[q]) / 1e3;
+  }
+  st->max_us = (double)all.max_ns / 1e3;
+  return 0;
+}
+
+static void print_scaling(const scale_shared *sh, const scale_step *steps,
+                          long n, int ncpus, output_format format) {
+  const bench_config *cfg = sh->cfg;
+  host_info h;
+  unsigned q;
+  long k, peak = 0;
+
+  for (k = 1; k < n; k++) {
+    if (steps[k].throughput > steps[peak].throughput) {
+      peak = k;
     }
   }
+
+  if (format == FORMAT_TEXT) {
+    printf("\nPeak: %ld thread%s (%.0f ops/s, %.2fx)\n", steps[peak].threads,
+           steps[peak].threads == 1 ? "" : "s", steps[peak].throughput,
+           steps[peak].speedup);
+    return;
+  }
+
+  if (format == FORMAT_JSON) {
+    json_head(cfg, sh->mix, sh->keys, sh->values);
+    printf(",\"scaling\":{\"pinned\":%s,\"timer_overhead_ns\":%llu,"
+           "\"steps\":[",
+           ncpus ? "true" : "false", (unsigned long long)sh->timer_ns);
+    for (k = 0; k < n; k++) {
+      const scale_step *st = &steps[k];
+      printf("%s{\"threads\":%ld,\"seconds\":%.6f,\"throughput\":%.1f,"
+             "\"speedup\":%.3f,\"failures\":%llu,\"hits\":%llu,"
+             "\"count\":%llu,\"avg_us\":%.3f",
+             k ? "," : "", st->threads, st->seconds, st->throughput,
+             st->speedup, (unsigned long long)st->failures,
+             (unsigned long long)st->hits, (unsigned long long)st->count,
+             st->avg_us);
+      for (q = 0; q < REPORT_Q_COUNT; q++) {
+        printf(",\"%s_us\":%.3f", report_q_names[q], st->q_us[q]);
+      }
+      printf(",\"max_us\":%.3f,", st->max_us);
+      if (cfg->perf) {
+        json_perf(&st->perf, (double)cfg->requests);
+      } else {
+        printf("\"perf\":null");
+      }
+      printf("}");
+    }
+    printf("],\"peak\":%ld}}\n", steps[peak].threads);
+    return;
+  }
+
+  host_info_get(&h);
+  printf("schema,benchmark,");
+  csv_host_header();
+  printf(",engine,requests,keyspace,shards,pinned,");
+  csv_workload_header();
+  printf(",threads,seconds,throughput,speedup,failures,hits,count,avg_us");
+  for (q = 0; q < REPORT_Q_COUNT; q++) {
+    printf(",%s_us", report_q_names[q]);
+  }
+  printf(",max_us,peak,");
+  csv_perf_header();
+  printf("\n");
+  for (k = 0; k < n; k++) {
+    const scale_step *st = &steps[k];
+    printf("%d,standalone,", RESULT_SCHEMA);
+    csv_host(&h);
+    printf(",%s,%ld,%ld,%ld,%d,", cfg->engine->name, cfg->requests,
+           cfg->keyspace, cfg->shards, ncpus > 0);
+    csv_workload(sh->mix, sh->keys, sh->values);
+    printf(",%ld,%.6f,%.1f,%.3f,%llu,%llu,%llu,%.3f", st->threads,
+           st->seconds, st->throughput, st->speedup,
+           (unsigned long long)st->failures, (unsigned long long)st->hits,
+           (unsigned long long)st->count, st->avg_us);
+    for (q = 0; q < REPORT_Q_COUNT; q++) {
+      printf(",%.3f", st->q_us[q]);
+    }
+    printf(",%.3f,%d,", st->max_us, k == peak);
+    csv_perf(&st->perf, (double)cfg->requests);
+    printf("\n");
+  }
 }
 
-static void record(metric *m, uint64_t elapsed_ns) {
-  m->count++;
-  m->total_ns += elapsed_ns;
+// --threads: the same workload at 1, 2, 4, ... and finally cfg->threads
+// threads, pinned round-robin to the CPUs the process may run on.
+static int run_scaling(scale_shared *sh, char *val, output_format format) {
+  const bench_config *cfg = sh->cfg;
+  static int cpus[CPU_SETSIZE];
+  int ncpus = 0;
+  cpu_set_t allowed;
+  scale_thread *threads;
+  scale_step *steps;
+  long n = 0, k, t;
+  int rc = 0;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    int c;
+    for (c = 0; c < CPU_SETSIZE; c++) {
+      if (CPU_ISSET(c, &allowed)) {
+        cpus[ncpus++] = c;
+      }
+    }
+  }
+
+  for (t = 1; t < cfg->threads; t *= 2) {
+    n++;
+  }
+  n++;
+  threads = (scale_thread *)calloc((size_t)cfg->threads, sizeof(*threads));
+  steps = (scale_step *)calloc((size_t)n, sizeof(*steps));
+  if (!threads || !steps) {
+    fprintf(stderr, "failed to allocate benchmark threads\n");
+    free(threads);
+    free(steps);
+    return -1;
+  }
+
+  if (format == FORMAT_TEXT) {
+    printf("\nScaling: 1..%ld threads, %ld shard%s, %s\n", cfg->threads,
+           cfg->shards, cfg->shards == 1 ? "" : "s",
+           ncpus ? "pinned" : "not pinned");
+    printf("%8s %12s %8s %9s %10s %10s %10s %10s\n", "threads", "ops/s",
+           "speedup", "failures", "p50 us", "p99 us", "p99.9 us", "max us");
+  }
+
+  for (k = 0, t = 1; k < n; k++, t *= 2) {
+    scale_step *st = &steps[k];
+    if (scale_run_step(sh, threads, k == n - 1 ? cfg->threads : t, cpus,
+                       ncpus, val, st) < 0) {
+      rc = -1;
+      break;
+    }
+    st->speedup = st->throughput / steps[0].throughput;
+    if (format == FORMAT_TEXT) {
+      printf("%8ld %12.0f %7.2fx %9llu %10.2f %10.2f %10.2f %10.2f\n",
+             st->threads, st->throughput, st->speedup,
+             (unsigned long long)st->failures, st->q_us[0],
+             st->q_us[SCALE_P99], st->q_us[SCALE_P99 + 1], st->max_us);
+      if (cfg->perf) {
+        print_perf(&st->perf, (double)cfg->requests);
+      }
+      fflush(stdout);
+    }
+  }
+  if (rc == 0) {
+    print_scaling(sh, steps, n, ncpus, format);
+  }
+
+  for (k = 0; k < cfg->threads; k++) {
+    free(threads[k].b.ops);
+    free(threads[k].b.arena);
+  }
+  free(threads);
+  free(steps);
+  return rc;
 }
 
 int main(int argc, char *argv[]) {
-  long requests;
-  long keyspace;
-  long i;
-  metric get_m = {0, 0}, set_m = {0, 0}, del_m = {0, 0};
-  uint64_t start_ns, end_ns;
-  uint64_t failures = 0;
-  unsigned rng = 0x9e3779b9U;
-  hashmap *hm;
+  bench_config cfg = {.engine = &engine_linear,
+                      .batch = BATCH_DEFAULT,
+                      .sample = 0.01,
+                      .shards = 1};
+  run_result res = {0};
+  long i, done;
+  static metric m[OP_COUNT];
+  uint64_t run_ns = 0;
+  unsigned rng = workload_seed(0);
+  unsigned sample_rng = 0x6a09e667U; // own stream, so sampling keeps the ops
+  uint32_t sample_below;
+  batch b = {0};
+  char *keytab;
+  uint64_t latest;
+  key_dist keys;
+  op_mix mix;
+  value_dist values;
+  char *val;
+  int keys_given = 0;
+  void *map;
+  output_format format = FORMAT_TEXT;
+  perf_set ps;
+  int opt;
+
+  static const struct option long_opts[] = {
+      {"keys", required_argument, NULL, 'k'},
+      {"mix", required_argument, NULL, 'm'},
+      {"values", required_argument, NULL, 'v'},
+      {"engine", required_argument, NULL, 'e'},
+      {"format", required_argument, NULL, 'f'},
+      {"pregen", no_argument, NULL, 'P'},
+      {"batch", required_argument, NULL, 'b'},
+      {"sample", required_argument, NULL, 's'},
+      {"threads", required_argument, NULL, 't'},
+      {"shards", required_argument, NULL, 'S'},
+      {"perf", no_argument, NULL, 'C'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  key_dist_parse(&keys, "uniform");
+  op_mix_parse(&mix, "default");
+  value_dist_parse(&values, "default");
+
+  while ((opt = getopt_long(argc, argv, "k:m:v:e:f:b:s:t:h", long_opts,
+                            NULL)) != -1) {
+    switch (opt) {
+    case 'k':
+      if (key_dist_parse(&keys, optarg) < 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      keys_given = 1;
+      break;
+    case 'm':
+      if (op_mix_parse(&mix, optarg) < 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'v':
+      value_dist_free(&values);
+      if (value_dist_parse(&values, optarg) < 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'e':
+      cfg.engine = engine_find(optarg);
+      if (!cfg.engine) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'f':
+      if (format_parse(&format, optarg) < 0) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'P':
+      cfg.pregen = 1;
+      break;
+    case 'b':
+      cfg.batch = atol(optarg);
+      break;
+    case 's':
+      cfg.sample = atof(optarg);
+      break;
+    case 't':
+      cfg.threads = atol(optarg);
+      break;
+    case 'S':
+      cfg.shards = atol(optarg);
+      break;
+    case 'C':
+      cfg.perf = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
 
-  if (argc != 3) {
+  if (argc - optind != 2) {
     usage(argv[0]);
     return 1;
   }
 
-  requests = atol(argv[1]);
-  keyspace = atol(argv[2]);
-  if (requests <= 0 || keyspace <= 0) {
+  cfg.requests = atol(argv[optind]);
+  cfg.keyspace = atol(argv[optind + 1]);
+  if (cfg.requests <= 0 || cfg.keyspace <= 0 || cfg.batch <= 0 ||
+      cfg.sample < 0 || cfg.sample > 1 || cfg.threads < 0 ||
+      cfg.threads > THREADS_MAX || cfg.shards <= 0) {
     usage(argv[0]);
     return 1;
   }
+  if (cfg.threads) {
+    cfg.pregen = 1; // each thread draws its part before the start barrier
+  }
+  if (cfg.pregen) {
+    cfg.batch = cfg.requests;
+  }
+  sample_below = (uint32_t)(cfg.sample * 16777216.0);
+
+  // Presets bring their own request distribution unless -k overrides it.
+  if (!keys_given && mix.keys != KEYS_UNIFORM) {
+    key_dist_parse(&keys, mix.keys == KEYS_LATEST ? "latest" : "zipfian");
+  }
+  key_dist_init(&keys, (uint32_t)cfg.keyspace);
+  latest = (uint64_t)cfg.keyspace;
 
-  hm = hashmap_create((size_t)keyspace);
-  if (!hm) {
-    fprintf(stderr, "failed to allocate hashmap\n");
+  val = (char *)malloc(values.max + 16);
+  keytab = key_table((uint32_t)cfg.keyspace);
+  if (!val || !keytab) {
+    fprintf(stderr, "failed to allocate the key table\n");
     return 1;
   }
 
-  printf("Standalone benchmark\n");
-  printf("Requests: %ld, Keyspace: %ld\n", requests, keyspace);
+  res.timer_ns = timer_overhead_ns();
+  if (cfg.perf && perf_open(&ps) == 0) {
+    fprintf(stderr, "hardware counters unavailable: %s\n", strerror(errno));
+  }
 
-  for (i = 0; i < keyspace; i++) {
-    char key[KEY_MAX];
-    char val[VAL_MAX];
-    snprintf(key, sizeof(key), "k%ld", i);
-    snprintf(val, sizeof(val), "v%ld", i);
-    if (hashmap_set(hm, key, val) < 0) {
-      failures++;
+  if (format == FORMAT_TEXT) {
+    printf("Standalone benchmark\n");
+    printf("Engine: %s\n", cfg.engine->name);
+    printf("Requests: %ld%s, Keyspace: %ld\n", cfg.requests,
+           cfg.pregen ? " (pre-generated)" : "", cfg.keyspace);
+    print_mix(&mix);
+    if (keys.kind == KEYS_HOTSPOT) {
+      printf("Keys: hotspot (%.0f%% of ops on %.0f%% of keys)\n",
+             keys.hot_ops * 100.0, keys.hot_frac * 100.0);
+    } else if (keys.kind != KEYS_UNIFORM) {
+      printf("Keys: %s (theta %.2f)\n", key_dist_name(&keys), keys.theta);
+    } else {
+      printf("Keys: uniform\n");
     }
+    value_dist_print(&values);
+    printf("Timing: batches of %ld, latency of %g%% of ops, clock overhead "
+           "%llu ns\n",
+           cfg.batch, cfg.sample * 100.0, (unsigned long long)res.timer_ns);
   }
 
-  // start_ns = now_ns();
-
-  for (i = 0; i < requests; i++) {
-    uint32_t key_id;
-    uint32_t bucket;
-    char key[KEY_MAX];
-    char val[VAL_MAX];
-    uint64_t t0, t1;
-
-    rng = rng * 1664525U + 1013904223U;
-    bucket = rng % 100;
-
-    rng = rng * 1664525U + 1013904223U;
-    key_id = rng % (uint32_t)keyspace;
-
-    snprintf(key, sizeof(key), "k%u", key_id);
-
-    if (bucket < 70) {
-      t0 = now_ns();
-      (void)hashmap_get(hm, key);
-      t1 = now_ns();
-      record(&get_m, t1 - t0);
-    } else if (bucket < 90) {
-      snprintf(val, sizeof(val), "v%u", key_id ^ rng);
-      t0 = now_ns();
-      if (hashmap_set(hm, key, val) < 0) {
-        failures++;
-      }
-      t1 = now_ns();
-      record(&set_m, t1 - t0);
-    } else {
-      t0 = now_ns();
-      hashmap_delete(hm, key);
-      t1 = now_ns();
-      record(&del_m, t1 - t0);
+  if (cfg.threads) {
+    scale_shared sh = {.cfg = &cfg,
+                       .mix = &mix,
+                       .keys = &keys,
+                       .values = &values,
+                       .keytab = keytab,
+                       .sample_below = sample_below,
+                       .timer_ns = res.timer_ns};
+    int rc;
+    if (cfg.perf) {
+      perf_close(&ps); // every thread opens its own
     }
+    rc = run_scaling(&sh, val, format);
+    free(val);
+    free(keytab);
+    value_dist_free(&values);
+    return rc < 0 ? 1 : 0;
+  }
+
+  res.mem.rss_before = mem_rss_bytes();
+  map = cfg.engine->create((size_t)cfg.keyspace);
+  if (!map) {
+    fprintf(stderr, "failed to allocate the %s map\n", cfg.engine->name);
+    return 1;
   }
+  warm_map(cfg.engine, map, cfg.keyspace, &values, val, &res);
+  res.mem.rss_after = mem_rss_bytes();
+  cfg.engine->mem(map, &res.mem);
+
+  // Requests are drawn a batch at a time outside the clock; only the map
+  // calls in between are timed. Sampled requests also get their own clock
+  // readings, less the calibrated overhead.
+  for (done = 0; done < cfg.requests; done += b.n) {
+    uint64_t t0;
+    long n = cfg.requests - done < cfg.batch ? cfg.requests - done
+                                             : cfg.batch;
+
+    if (batch_fill(&b, n, cfg.pregen ? SIZE_MAX : BATCH_ARENA_MAX, &mix,
+                   &keys, &values, &rng, &latest) < 0) {
+      fprintf(stderr, "failed to allocate the request batch\n");
+      return 1;
+    }
 
-  // end_ns = now_ns();
+    if (cfg.perf) {
+      perf_enable(&ps);
+    }
+    t0 = now_ns();
+    run_batch(cfg.engine, map, &b, keytab, (uint32_t)cfg.keyspace,
+              sample_below, &sample_rng, m, &res);
+    run_ns += now_ns() - t0;
+    if (cfg.perf) {
+      perf_disable(&ps);
+    }
+  }
+  if (cfg.perf) {
+    perf_read(&ps, &res.perf);
+    perf_close(&ps);
+  }
 
-  {
-    // uint64_t total_ns = end_ns - start_ns;
-    // double seconds = (double)total_ns / 1e9;
-    // double rps = (double)requests / seconds;
+  res.seconds = (double)run_ns / 1e9;
+  res.throughput = (double)cfg.requests / res.seconds;
 
+  if (format == FORMAT_JSON) {
+    print_json(&cfg, &mix, &keys, &values, m, &res);
+  } else if (format == FORMAT_CSV) {
+    print_csv(&cfg, &mix, &keys, &values, m, &res);
+  } else {
     printf("\nResults\n");
-    // printf("  Total time: %.3f s\n", seconds);
-    // printf("  Throughput: %.0f ops/s\n", rps);
-    printf("  Failures: %llu\n", (unsigned long long)failures);
-
-    // if (get_m.count) {
-    //   printf("  GET avg: %.3f us (%llu ops)\n",
-    //          ((double)get_m.total_ns / (double)get_m.count) / 1e3,
-    //          (unsigned long long)get_m.count);
-    // }
-    // if (set_m.count) {
-    //   printf("  SET avg: %.3f us (%llu ops)\n",
-    //          ((double)set_m.total_ns / (double)set_m.count) / 1e3,
-    //          (unsigned long long)set_m.count);
-    // }
-    // if (del_m.count) {
-    //   printf("  DEL avg: %.3f us (%llu ops)\n",
-    //          ((double)del_m.total_ns / (double)del_m.count) / 1e3,
-    //          (unsigned long long)del_m.count);
-    // }
-  }
-
-  hashmap_destroy(hm);
-  return failures == 0 ? 0 : 2;
+    printf("  Total time: %.3f s\n", res.seconds);
+    printf("  Throughput: %.0f ops/s\n", res.throughput);
+    printf("  Failures: %llu\n", (unsigned long long)res.failures);
+    printf("  Read hits: %llu\n", (unsigned long long)res.hits);
+    if (cfg.perf) {
+      print_perf(&res.perf, (double)cfg.requests);
+    }
+    print_mem(&res.mem);
+
+    for (i = 0; i < OP_COUNT; i++) {
+      print_metric(op_names[i], &m[i]);
+    }
+  }
+
+  cfg.engine->destroy(map);
+  free(val);
+  free(b.ops);
+  free(b.arena);
+  free(keytab);
+  value_dist_free(&values);
+  return res.failures == 0 ? 0 : 2;
 }
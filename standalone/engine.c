@@ -0,0 +1,15 @@
+#include "engine.h"
+
+#include <string.h>
+
+const engine *const engines[] = {&engine_linear, &engine_chained, NULL};
+
+const engine *engine_find(const char *name) {
+  size_t i;
+  for (i = 0; engines[i]; i++) {
+    if (strcmp(engines[i]->name, name) == 0) {
+      return engines[i];
+    }
+  }
+  return NULL;
+}
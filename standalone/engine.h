@@ -0,0 +1,48 @@
+#ifndef BENCHCACHED_ENGINE_H
+#define BENCHCACHED_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hash.h"
+#include "mem.h"
+
+// A map backend under test. Keys and values are NUL-terminated strings the
+// map copies; get returns the stored value or NULL.
+typedef struct {
+  const char *name;
+  const char *desc; // one line for the usage text
+  void *(*create)(size_t expected_items);
+  const char *(*get)(void *map, const char *key);
+  int (*set)(void *map, const char *key, const char *val); // -1 on failure
+  void (*del)(void *map, const char *key);
+  void (*destroy)(void *map);
+  void (*mem)(void *map, mem_report *m); // adds keys and bytes held to m
+} engine;
+
+extern const engine engine_linear;
+extern const engine engine_chained;
+
+// NULL-terminated, the default first.
+extern const engine *const engines[];
+
+const engine *engine_find(const char *name);
+
+// Any engine made safe to share between threads: keys are spread by hash
+// over shards, each its own instance of e behind a rwlock, so gets run
+// concurrently and writes serialize per shard. Drive the result through
+// engine_locked, whose create is NULL; its get only tells a hit from a
+// miss, as another thread may free the value once the shard lock drops.
+void *locked_create(const engine *e, size_t expected_items, unsigned shards);
+
+extern const engine engine_locked;
+
+static inline size_t next_pow2(size_t x) {
+  size_t p = 1;
+  while (p < x) {
+    p <<= 1;
+  }
+  return p;
+}
+
+#endif
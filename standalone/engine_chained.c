@@ -0,0 +1,162 @@
+#include "engine.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Separate chaining: a power-of-two bucket array of singly linked nodes,
+// each holding its key inline. The array doubles once the map holds more
+// keys than buckets, so sets only fail when malloc does.
+typedef struct chain_node {
+  struct chain_node *next;
+  char *val;
+  char key[];
+} chain_node;
+
+typedef struct {
+  chain_node **buckets;
+  size_t cap;
+  size_t count;
+} chain_map;
+
+static void *chained_create(size_t expected_items) {
+  chain_map *cm = (chain_map *)malloc(sizeof(*cm));
+  if (!cm) {
+    return NULL;
+  }
+  cm->cap = next_pow2(expected_items + 1);
+  cm->count = 0;
+  cm->buckets = (chain_node **)calloc(cm->cap, sizeof(*cm->buckets));
+  if (!cm->buckets) {
+    free(cm);
+    return NULL;
+  }
+  return cm;
+}
+
+static void chained_destroy(void *map) {
+  chain_map *cm = (chain_map *)map;
+  size_t i;
+  if (!cm) {
+    return;
+  }
+  for (i = 0; i < cm->cap; i++) {
+    chain_node *n = cm->buckets[i];
+    while (n) {
+      chain_node *next = n->next;
+      free(n->val);
+      free(n);
+      n = next;
+    }
+  }
+  free(cm->buckets);
+  free(cm);
+}
+
+// Rehashes into twice the buckets; on allocation failure the map stays as
+// it was, only with longer chains.
+static void chained_grow(chain_map *cm) {
+  size_t cap = cm->cap * 2;
+  chain_node **buckets = (chain_node **)calloc(cap, sizeof(*buckets));
+  size_t i;
+  if (!buckets) {
+    return;
+  }
+  for (i = 0; i < cm->cap; i++) {
+    chain_node *n = cm->buckets[i];
+    while (n) {
+      chain_node *next = n->next;
+      size_t idx = (size_t)(fnv_hash(n->key) & (uint64_t)(cap - 1));
+      n->next = buckets[idx];
+      buckets[idx] = n;
+      n = next;
+    }
+  }
+  free(cm->buckets);
+  cm->buckets = buckets;
+  cm->cap = cap;
+}
+
+static chain_node **chained_find(chain_map *cm, const char *key) {
+  size_t idx = (size_t)(fnv_hash(key) & (uint64_t)(cm->cap - 1));
+  chain_node **link = &cm->buckets[idx];
+  while (*link && strcmp((*link)->key, key) != 0) {
+    link = &(*link)->next;
+  }
+  return link;
+}
+
+static int chained_set(void *map, const char *key, const char *val) {
+  chain_map *cm = (chain_map *)map;
+  chain_node **link = chained_find(cm, key);
+  char *new_val = strdup(val);
+  size_t klen;
+
+  if (!new_val) {
+    return -1;
+  }
+  if (*link) {
+    free((*link)->val);
+    (*link)->val = new_val;
+    return 0;
+  }
+
+  klen = strlen(key) + 1;
+  *link = (chain_node *)malloc(sizeof(chain_node) + klen);
+  if (!*link) {
+    free(new_val);
+    return -1;
+  }
+  (*link)->next = NULL;
+  (*link)->val = new_val;
+  memcpy((*link)->key, key, klen);
+  if (++cm->count > cm->cap) {
+    chained_grow(cm);
+  }
+  return 0;
+}
+
+static const char *chained_get(void *map, const char *key) {
+  chain_node *n = *chained_find((chain_map *)map, key);
+  return n ? n->val : NULL;
+}
+
+static void chained_delete(void *map, const char *key) {
+  chain_map *cm = (chain_map *)map;
+  chain_node **link = chained_find(cm, key);
+  chain_node *n = *link;
+  if (!n) {
+    return;
+  }
+  *link = n->next;
+  free(n->val);
+  free(n);
+  cm->count--;
+}
+
+static void chained_mem(void *map, mem_report *m) {
+  const chain_map *cm = (const chain_map *)map;
+  size_t i;
+
+  m->table_bytes += sizeof(*cm) + cm->cap * sizeof(*cm->buckets);
+  m->alloc_bytes += mem_alloc_bytes(cm) + mem_alloc_bytes(cm->buckets);
+  for (i = 0; i < cm->cap; i++) {
+    const chain_node *n;
+    for (n = cm->buckets[i]; n; n = n->next) {
+      m->keys++;
+      m->item_bytes +=
+          sizeof(chain_node) + strlen(n->key) + strlen(n->val) + 2;
+      m->alloc_bytes += mem_alloc_bytes(n) + mem_alloc_bytes(n->val);
+    }
+  }
+}
+
+const engine engine_chained = {
+    .name = "chained",
+    .desc = "separate chaining, grows at load factor 1",
+    .create = chained_create,
+    .get = chained_get,
+    .set = chained_set,
+    .del = chained_delete,
+    .destroy = chained_destroy,
+    .mem = chained_mem,
+};
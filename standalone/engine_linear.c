@@ -0,0 +1,184 @@
+#include "engine.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+// Open addressing with linear probing and tombstones, sized to twice the
+// keyspace up front; sets fail once every slot has been used.
+typedef struct {
+  char *key;
+  char *val;
+  int used;
+  int deleted;
+} kv_entry;
+
+typedef struct {
+  kv_entry *entries;
+  size_t cap;
+} hashmap;
+
+static void *linear_create(size_t expected_items) {
+  hashmap *hm;
+  size_t cap = next_pow2(expected_items * 2 + 1);
+
+  hm = (hashmap *)malloc(sizeof(*hm));
+  if (!hm) {
+    return NULL;
+  }
+
+  hm->entries = (kv_entry *)calloc(cap, sizeof(kv_entry));
+  if (!hm->entries) {
+    free(hm);
+    return NULL;
+  }
+
+  hm->cap = cap;
+  return hm;
+}
+
+static void linear_destroy(void *map) {
+  hashmap *hm = (hashmap *)map;
+  size_t i;
+  if (!hm) {
+    return;
+  }
+  for (i = 0; i < hm->cap; i++) {
+    if (hm->entries[i].used && !hm->entries[i].deleted) {
+      free(hm->entries[i].key);
+      free(hm->entries[i].val);
+    }
+  }
+  free(hm->entries);
+  free(hm);
+}
+
+static int linear_set(void *map, const char *key, const char *val) {
+  hashmap *hm = (hashmap *)map;
+  size_t i;
+  size_t idx = (size_t)(fnv_hash(key) & (uint64_t)(hm->cap - 1));
+  ssize_t first_tomb = -1;
+
+  for (i = 0; i < hm->cap; i++) {
+    size_t probe = (idx + i) & (hm->cap - 1);
+    kv_entry *e = &hm->entries[probe];
+
+    if (!e->used) {
+      kv_entry *dst;
+      if (first_tomb >= 0) {
+        dst = &hm->entries[(size_t)first_tomb];
+      } else {
+        dst = e;
+      }
+      dst->key = strdup(key);
+      dst->val = strdup(val);
+      if (!dst->key || !dst->val) {
+        free(dst->key);
+        free(dst->val);
+        dst->key = NULL;
+        dst->val = NULL;
+        dst->used = 0;
+        dst->deleted = 0;
+        return -1;
+      }
+      dst->used = 1;
+      dst->deleted = 0;
+      return 0;
+    }
+
+    if (e->deleted) {
+      if (first_tomb < 0) {
+        first_tomb = (ssize_t)probe;
+      }
+      continue;
+    }
+
+    if (strcmp(e->key, key) == 0) {
+      char *new_val = strdup(val);
+      if (!new_val) {
+        return -1;
+      }
+      free(e->val);
+      e->val = new_val;
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+static const char *linear_get(void *map, const char *key) {
+  const hashmap *hm = (const hashmap *)map;
+  size_t i;
+  size_t idx = (size_t)(fnv_hash(key) & (uint64_t)(hm->cap - 1));
+
+  for (i = 0; i < hm->cap; i++) {
+    size_t probe = (idx + i) & (hm->cap - 1);
+    const kv_entry *e = &hm->entries[probe];
+
+    if (!e->used) {
+      return NULL;
+    }
+    if (e->deleted) {
+      continue;
+    }
+    if (strcmp(e->key, key) == 0) {
+      return e->val;
+    }
+  }
+
+  return NULL;
+}
+
+static void linear_delete(void *map, const char *key) {
+  hashmap *hm = (hashmap *)map;
+  size_t i;
+  size_t idx = (size_t)(fnv_hash(key) & (uint64_t)(hm->cap - 1));
+
+  for (i = 0; i < hm->cap; i++) {
+    size_t probe = (idx + i) & (hm->cap - 1);
+    kv_entry *e = &hm->entries[probe];
+
+    if (!e->used) {
+      return;
+    }
+    if (e->deleted) {
+      continue;
+    }
+    if (strcmp(e->key, key) == 0) {
+      free(e->key);
+      free(e->val);
+      e->key = NULL;
+      e->val = NULL;
+      e->deleted = 1;
+      return;
+    }
+  }
+}
+
+static void linear_mem(void *map, mem_report *m) {
+  const hashmap *hm = (const hashmap *)map;
+  size_t i;
+
+  m->table_bytes += sizeof(*hm) + hm->cap * sizeof(kv_entry);
+  m->alloc_bytes += mem_alloc_bytes(hm) + mem_alloc_bytes(hm->entries);
+  for (i = 0; i < hm->cap; i++) {
+    const kv_entry *e = &hm->entries[i];
+    if (e->used && !e->deleted) {
+      m->keys++;
+      m->item_bytes += strlen(e->key) + strlen(e->val) + 2;
+      m->alloc_bytes += mem_alloc_bytes(e->key) + mem_alloc_bytes(e->val);
+    }
+  }
+}
+
+const engine engine_linear = {
+    .name = "linear",
+    .desc = "open addressing, linear probing (default)",
+    .create = linear_create,
+    .get = linear_get,
+    .set = linear_set,
+    .del = linear_delete,
+    .destroy = linear_destroy,
+    .mem = linear_mem,
+};
@@ -0,0 +1,111 @@
+#include "engine.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+// Shards sit on their own cache lines so one shard's lock traffic doesn't
+// slow its neighbours.
+typedef struct {
+  pthread_rwlock_t lock;
+  void *map;
+} __attribute__((aligned(64))) locked_shard;
+
+typedef struct {
+  const engine *e;
+  unsigned count;
+  locked_shard *shards;
+} locked_map;
+
+static void locked_destroy(void *map) {
+  locked_map *lm = (locked_map *)map;
+  unsigned i;
+  if (!lm) {
+    return;
+  }
+  for (i = 0; i < lm->count; i++) {
+    lm->e->destroy(lm->shards[i].map);
+    pthread_rwlock_destroy(&lm->shards[i].lock);
+  }
+  free(lm->shards);
+  free(lm);
+}
+
+void *locked_create(const engine *e, size_t expected_items, unsigned shards) {
+  locked_map *lm = (locked_map *)calloc(1, sizeof(*lm));
+  unsigned i;
+  if (!lm) {
+    return NULL;
+  }
+  lm->e = e;
+  lm->shards =
+      (locked_shard *)aligned_alloc(64, (size_t)shards * sizeof(locked_shard));
+  if (!lm->shards) {
+    free(lm);
+    return NULL;
+  }
+  for (i = 0; i < shards; i++) {
+    lm->shards[i].map = e->create(expected_items / shards + 1);
+    if (!lm->shards[i].map) {
+      locked_destroy(lm);
+      return NULL;
+    }
+    pthread_rwlock_init(&lm->shards[i].lock, NULL);
+    lm->count = i + 1;
+  }
+  return lm;
+}
+
+// Engines index with the low hash bits, so the shard comes from the high
+// ones. FNV leaves those nearly constant for short keys, so mix them first.
+static locked_shard *locked_shard_of(void *map, const char *key) {
+  locked_map *lm = (locked_map *)map;
+  uint64_t h = fnv_hash(key) * 0x9e3779b97f4a7c15ULL;
+  return &lm->shards[(h >> 32) % lm->count];
+}
+
+static const char *locked_get(void *map, const char *key) {
+  locked_shard *s = locked_shard_of(map, key);
+  const char *val;
+  pthread_rwlock_rdlock(&s->lock);
+  val = ((locked_map *)map)->e->get(s->map, key);
+  pthread_rwlock_unlock(&s->lock);
+  return val;
+}
+
+static int locked_set(void *map, const char *key, const char *val) {
+  locked_shard *s = locked_shard_of(map, key);
+  int rc;
+  pthread_rwlock_wrlock(&s->lock);
+  rc = ((locked_map *)map)->e->set(s->map, key, val);
+  pthread_rwlock_unlock(&s->lock);
+  return rc;
+}
+
+static void locked_delete(void *map, const char *key) {
+  locked_shard *s = locked_shard_of(map, key);
+  pthread_rwlock_wrlock(&s->lock);
+  ((locked_map *)map)->e->del(s->map, key);
+  pthread_rwlock_unlock(&s->lock);
+}
+
+static void locked_mem(void *map, mem_report *m) {
+  const locked_map *lm = (const locked_map *)map;
+  unsigned i;
+
+  m->table_bytes += sizeof(*lm) + lm->count * sizeof(locked_shard);
+  m->alloc_bytes += mem_alloc_bytes(lm) + mem_alloc_bytes(lm->shards);
+  for (i = 0; i < lm->count; i++) {
+    lm->e->mem(lm->shards[i].map, m);
+  }
+}
+
+const engine engine_locked = {
+    .name = "locked",
+    .desc = "another engine sharded behind rwlocks",
+    .create = NULL,
+    .get = locked_get,
+    .set = locked_set,
+    .del = locked_delete,
+    .destroy = locked_destroy,
+    .mem = locked_mem,
+};